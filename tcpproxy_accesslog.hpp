@@ -0,0 +1,52 @@
+//
+// tcpproxy_accesslog.hpp
+// ~~~~~~~~~~~~~~~~~~~~~~
+//
+// Distributed under the Boost Software License, Version 1.0.
+//
+//
+// Description
+// ~~~~~~~~~~~
+// On-disk format of the binary access log (--accesslog): a small
+// file header followed by fixed-size records, one per closed
+// connection. Shared between tcpproxy_server, which appends the
+// records, and tcpproxy_logcat, which renders them as text.
+//
+
+#ifndef TCPPROXY_ACCESSLOG_HPP
+#define TCPPROXY_ACCESSLOG_HPP
+
+
+namespace tcp_proxy
+{
+   enum class access_reason : unsigned char
+   {
+      eof          = 0, // both directions drained to EOF
+      error        = 1, // transfer failed mid-flight
+      timeout      = 2, // connect, idle or write deadline fired
+      connect_fail = 3  // upstream connect or handshake failed
+   };
+
+   struct access_record
+   {
+      char peer   [64] = { 0 };              // client address:port
+      char backend[64] = { 0 };              // selected backend host:port
+      unsigned long long a_bytes        = 0; // remote server --> client
+      unsigned long long b_bytes        = 0; // client --> remote server
+      unsigned long long open_unix_msec = 0; // wall-clock open time
+      unsigned int duration_msec        = 0;
+      unsigned int connect_usec         = 0;
+      unsigned char reason              = 0; // access_reason
+      unsigned char pad[7]              = { 0 };
+   };
+
+   struct access_log_header
+   {
+      char magic[4]            = { 'T', 'P', 'A', 'L' };
+      unsigned int version     = 1;
+      unsigned int record_size = sizeof(access_record);
+      unsigned int reserved    = 0;
+   };
+}
+
+#endif
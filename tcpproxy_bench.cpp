@@ -0,0 +1,316 @@
+//
+// tcpproxy_bench.cpp
+// ~~~~~~~~~~~~~~~~~~
+//
+// Distributed under the Boost Software License, Version 1.0.
+//
+//
+// Description
+// ~~~~~~~~~~~
+// Self-contained benchmark harness for the TCP proxy server. It hosts
+// an echo sink and a traffic generator in one process: the generator
+// opens a configurable number of connections *through the proxy* to
+// the sink, ping-pongs fixed-size messages for a fixed duration, then
+// churns connections for a short window. It reports:
+//
+//   - forwarded throughput (Gbit/s, both directions through the proxy)
+//   - message round trips per second
+//   - p50/p99/p999 round-trip forwarding latency
+//   - connection setup rate (connections/sec)
+//
+// Typical use (also wired up as `make bench`):
+//
+//   ./tcpproxy_server 127.0.0.1 18081 127.0.0.1 18082 &
+//   ./tcpproxy_bench  127.0.0.1 18081 18082 [connections] [msg bytes] [seconds]
+//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstddef>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <asio.hpp>
+
+namespace tcp_proxy_bench
+{
+   namespace ip = asio::ip;
+
+   typedef std::chrono::steady_clock clock_type;
+
+   /*
+      Echo sink: a minimal asio echo server the proxy forwards to.
+   */
+
+   class echo_session : public std::enable_shared_from_this<echo_session>
+   {
+   public:
+
+      explicit echo_session(asio::io_context& ios)
+      : socket_(ios)
+      {}
+
+      ip::tcp::socket& socket() { return socket_; }
+
+      void start()
+      {
+         read();
+      }
+
+   private:
+
+      void read()
+      {
+         auto self = shared_from_this();
+
+         socket_.async_read_some(
+              asio::buffer(data_,sizeof(data_)),
+              [this, self](const std::error_code& error, const std::size_t bytes_transferred)
+              {
+                 if (error)
+                    return;
+
+                 asio::async_write(socket_,
+                      asio::buffer(data_,bytes_transferred),
+                      [this, self](const std::error_code& error, const std::size_t)
+                      {
+                         if (!error)
+                            read();
+                      });
+              });
+      }
+
+      ip::tcp::socket socket_;
+      unsigned char data_[65536];
+   };
+
+   class echo_sink
+   {
+   public:
+
+      echo_sink(asio::io_context& ios, const unsigned short port)
+      : ios_(ios),
+        acceptor_(ios,ip::tcp::endpoint(ip::address_v4::loopback(),port))
+      {
+         accept();
+      }
+
+   private:
+
+      void accept()
+      {
+         std::shared_ptr<echo_session> session(new echo_session(ios_));
+
+         acceptor_.async_accept(session->socket(),
+              [this, session](const std::error_code& error)
+              {
+                 if (!error)
+                 {
+                    session->start();
+                 }
+
+                 accept();
+              });
+      }
+
+      asio::io_context& ios_;
+      ip::tcp::acceptor acceptor_;
+   };
+
+   /*
+      Traffic generator: blocking asio sockets, one worker thread per
+      connection, per-worker latency samples merged at the end.
+   */
+
+   struct worker_stats
+   {
+      unsigned long long bytes      = 0;
+      unsigned long long round_trips = 0;
+      std::vector<unsigned int> latencies_usec;
+   };
+
+   void run_worker(const std::string& proxy_host, const unsigned short proxy_port,
+                   const std::size_t message_size, const clock_type::time_point deadline,
+                   worker_stats& stats)
+   {
+      try
+      {
+         asio::io_context ios;
+
+         ip::tcp::socket socket(ios);
+         socket.connect(ip::tcp::endpoint(asio::ip::make_address(proxy_host),proxy_port));
+         socket.set_option(ip::tcp::no_delay(true));
+
+         std::vector<unsigned char> send_data(message_size,0xA5);
+         std::vector<unsigned char> recv_data(message_size);
+
+         stats.latencies_usec.reserve(1 << 20);
+
+         while (clock_type::now() < deadline)
+         {
+            const clock_type::time_point t0 = clock_type::now();
+
+            asio::write(socket,asio::buffer(send_data));
+            asio::read (socket,asio::buffer(recv_data));
+
+            const clock_type::time_point t1 = clock_type::now();
+
+            if (stats.latencies_usec.size() < stats.latencies_usec.capacity())
+            {
+               stats.latencies_usec.push_back(
+                  static_cast<unsigned int>(
+                     std::chrono::duration_cast<std::chrono::microseconds>(t1 - t0).count()));
+            }
+
+            stats.bytes += 2 * message_size; // both directions through the proxy
+            ++stats.round_trips;
+         }
+      }
+      catch(std::exception& e)
+      {
+         std::cerr << "worker error: " << e.what() << std::endl;
+      }
+   }
+
+   unsigned long long run_churn(const std::string& proxy_host, const unsigned short proxy_port,
+                                const double seconds)
+   {
+      unsigned long long connections = 0;
+
+      const clock_type::time_point deadline =
+         clock_type::now() + std::chrono::milliseconds(static_cast<long>(seconds * 1000));
+
+      try
+      {
+         asio::io_context ios;
+
+         while (clock_type::now() < deadline)
+         {
+            ip::tcp::socket socket(ios);
+            socket.connect(ip::tcp::endpoint(asio::ip::make_address(proxy_host),proxy_port));
+            socket.close();
+            ++connections;
+         }
+      }
+      catch(std::exception& e)
+      {
+         std::cerr << "churn error: " << e.what() << std::endl;
+      }
+
+      return connections;
+   }
+
+   unsigned int percentile(std::vector<unsigned int>& sorted_usec, const double p)
+   {
+      if (sorted_usec.empty())
+         return 0;
+
+      std::size_t index = static_cast<std::size_t>(p * (sorted_usec.size() - 1));
+
+      return sorted_usec[index];
+   }
+}
+
+int main(int argc, char* argv[])
+{
+   if ((argc < 4) || (argc > 7))
+   {
+      std::cerr << "usage: tcpproxy_bench <proxy host> <proxy port> <sink port> "
+                   "[connections] [message bytes] [seconds]" << std::endl;
+      return 1;
+   }
+
+   const std::string proxy_host    = argv[1];
+   const unsigned short proxy_port = static_cast<unsigned short>(::atoi(argv[2]));
+   const unsigned short sink_port  = static_cast<unsigned short>(::atoi(argv[3]));
+
+   const std::size_t connections  = (argc > 4) ? static_cast<std::size_t>(::atoi(argv[4])) : 8;
+   const std::size_t message_size = (argc > 5) ? static_cast<std::size_t>(::atol(argv[5])) : 16384;
+   const double duration          = (argc > 6) ? ::atof(argv[6]) : 10.0;
+
+   using namespace tcp_proxy_bench;
+
+   try
+   {
+      // Host the echo sink on its own thread
+      asio::io_context sink_ios;
+      echo_sink sink(sink_ios,sink_port);
+
+      std::thread sink_thread([&sink_ios]() { sink_ios.run(); });
+
+      std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+      // Phase 1: throughput and round-trip latency
+      const clock_type::time_point start    = clock_type::now();
+      const clock_type::time_point deadline = start +
+         std::chrono::milliseconds(static_cast<long>(duration * 1000));
+
+      std::vector<worker_stats> stats(connections);
+      std::vector<std::thread> workers;
+
+      for (std::size_t i = 0; i < connections; ++i)
+      {
+         workers.emplace_back(run_worker,
+                              proxy_host, proxy_port,
+                              message_size, deadline,
+                              std::ref(stats[i]));
+      }
+
+      for (std::size_t i = 0; i < workers.size(); ++i)
+      {
+         workers[i].join();
+      }
+
+      const double elapsed =
+         std::chrono::duration_cast<std::chrono::duration<double>>(
+            clock_type::now() - start).count();
+
+      unsigned long long total_bytes       = 0;
+      unsigned long long total_round_trips = 0;
+
+      std::vector<unsigned int> latencies;
+
+      for (std::size_t i = 0; i < stats.size(); ++i)
+      {
+         total_bytes       += stats[i].bytes;
+         total_round_trips += stats[i].round_trips;
+
+         latencies.insert(latencies.end(),
+                          stats[i].latencies_usec.begin(),
+                          stats[i].latencies_usec.end());
+      }
+
+      std::sort(latencies.begin(),latencies.end());
+
+      // Phase 2: connection setup rate
+      const double churn_seconds               = std::min(2.0,duration);
+      const unsigned long long churn_connects  = run_churn(proxy_host,proxy_port,churn_seconds);
+
+      sink_ios.stop();
+      sink_thread.join();
+
+      const double gbit_per_sec = (total_bytes * 8.0) / (elapsed * 1e9);
+
+      std::cout << "connections      : " << connections                        << std::endl;
+      std::cout << "message size     : " << message_size << " bytes"           << std::endl;
+      std::cout << "duration         : " << elapsed << " s"                    << std::endl;
+      std::cout << "throughput       : " << gbit_per_sec << " Gbit/s"          << std::endl;
+      std::cout << "round trips/sec  : " << (total_round_trips / elapsed)      << std::endl;
+      std::cout << "latency p50      : " << percentile(latencies,0.50) << " us" << std::endl;
+      std::cout << "latency p99      : " << percentile(latencies,0.99) << " us" << std::endl;
+      std::cout << "latency p999     : " << percentile(latencies,0.999) << " us" << std::endl;
+      std::cout << "connects/sec     : " << (churn_connects / churn_seconds)   << std::endl;
+   }
+   catch(std::exception& e)
+   {
+      std::cerr << "Error: " << e.what() << std::endl;
+      return 1;
+   }
+
+   return 0;
+}
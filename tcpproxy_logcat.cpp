@@ -0,0 +1,121 @@
+//
+// tcpproxy_logcat.cpp
+// ~~~~~~~~~~~~~~~~~~~
+//
+// Distributed under the Boost Software License, Version 1.0.
+//
+//
+// Description
+// ~~~~~~~~~~~
+// Renders the binary access log written by tcpproxy_server
+// (--accesslog) as text, one line per closed connection:
+//
+//   ./tcpproxy_logcat <access log file>
+//
+
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+
+#include "tcpproxy_accesslog.hpp"
+
+
+namespace
+{
+   const char* reason_name(const unsigned char reason)
+   {
+      switch (static_cast<tcp_proxy::access_reason>(reason))
+      {
+         case tcp_proxy::access_reason::eof          : return "eof";
+         case tcp_proxy::access_reason::error        : return "error";
+         case tcp_proxy::access_reason::timeout      : return "timeout";
+         case tcp_proxy::access_reason::connect_fail : return "connect_fail";
+         default                                     : return "unknown";
+      }
+   }
+
+   void format_time(const unsigned long long unix_msec, char (&text)[32])
+   {
+      const std::time_t seconds = static_cast<std::time_t>(unix_msec / 1000);
+
+      std::tm utc;
+      ::gmtime_r(&seconds,&utc);
+
+      char stamp[24];
+      std::strftime(stamp,sizeof(stamp),"%Y-%m-%dT%H:%M:%S",&utc);
+
+      std::snprintf(text,sizeof(text),"%s.%03uZ",
+                    stamp,
+                    static_cast<unsigned int>(unix_msec % 1000));
+   }
+}
+
+int main(int argc, char* argv[])
+{
+   if (argc != 2)
+   {
+      std::cerr << "usage: tcpproxy_logcat <access log file>" << std::endl;
+      return 1;
+   }
+
+   std::ifstream log(argv[1],std::ios::binary);
+
+   if (!log)
+   {
+      std::cerr << "Error: cannot open: " << argv[1] << std::endl;
+      return 1;
+   }
+
+   tcp_proxy::access_log_header header;
+
+   if (!log.read(reinterpret_cast<char*>(&header),sizeof(header)))
+   {
+      std::cerr << "Error: truncated file header" << std::endl;
+      return 1;
+   }
+
+   const tcp_proxy::access_log_header expected;
+
+   if (
+        (header.magic[0] != expected.magic[0]) ||
+        (header.magic[1] != expected.magic[1]) ||
+        (header.magic[2] != expected.magic[2]) ||
+        (header.magic[3] != expected.magic[3])
+      )
+   {
+      std::cerr << "Error: not an access log (bad magic)" << std::endl;
+      return 1;
+   }
+
+   if (
+        (header.version     != expected.version    ) ||
+        (header.record_size != expected.record_size)
+      )
+   {
+      std::cerr << "Error: unsupported log version "   << header.version
+                << " (record size " << header.record_size << ")" << std::endl;
+      return 1;
+   }
+
+   tcp_proxy::access_record record;
+
+   while (log.read(reinterpret_cast<char*>(&record),sizeof(record)))
+   {
+      char stamp[32];
+      format_time(record.open_unix_msec,stamp);
+
+      std::printf("%s peer=%s backend=%s in_bytes=%llu out_bytes=%llu "
+                  "connect_us=%u duration_ms=%u reason=%s\n",
+                  stamp,
+                  record.peer,
+                  record.backend,
+                  record.b_bytes,
+                  record.a_bytes,
+                  record.connect_usec,
+                  record.duration_msec,
+                  reason_name(record.reason));
+   }
+
+   return 0;
+}
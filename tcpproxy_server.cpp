@@ -46,278 +46,4948 @@
 //
 
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <cstdlib>
 #include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <csignal>
+#include <fstream>
+#include <functional>
 #include <iostream>
 #include <string>
 #include <memory>
 #include <mutex>
+#include <stdexcept>
 #include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
 
 #include <asio.hpp>
 
+#include "tcpproxy_accesslog.hpp"
+
+#ifdef TCPPROXY_TLS
+#include <asio/ssl.hpp>
+#endif
+
+#ifdef __linux__
+#include <cerrno>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
 namespace tcp_proxy
 {
    namespace ip = asio::ip;
 
-   class bridge : public std::enable_shared_from_this<bridge>
+   // How payload moves between the two sockets of a bridge. The
+   // buffered engine is the portable default; the spliced engine moves
+   // data kernel-to-kernel through a pipe pair and never touches
+   // userspace (Linux only, selected with --splice); the coroutine
+   // engine runs each direction as a C++20 coroutine whose read/write
+   // loop costs one suspension per operation instead of a handler
+   // dispatch (--coro, needs coroutine support in the toolchain).
+   enum class forwarding_engine
+   {
+      buffered,
+      spliced,
+      coroutine
+   };
+
+   static forwarding_engine engine_mode = forwarding_engine::buffered;
+
+   // Upper bound on bytes queued (read but not yet written) per
+   // direction of a bridge before reads are paused (--highwater).
+   static std::size_t pipeline_high_water = 262144; //256KB
+
+   // Number of pre-established upstream connections each reactor's
+   // acceptor keeps warm (--warmpool, 0 disables the pool).
+   static std::size_t warm_pool_target = 0;
+
+   // Per-reactor overload limits, derived in main() from the global
+   // --maxconn / --acceptrate values divided across reactors. Zero
+   // means unlimited.
+   static std::size_t max_bridges_per_reactor = 0;
+   static double accept_rate_per_reactor      = 0;
+
+   // Number of concurrent outstanding accepts per reactor (--accepts).
+   // Each carries its own pre-constructed bridge, so a connection
+   // burst is absorbed depth accepts per loop pass instead of one.
+   static std::size_t accept_depth = 1;
+
+   // Relay UDP datagrams on the same local port alongside the TCP
+   // bridges (--udp); sessions idle out after --udpidle seconds.
+   static bool udp_enable       = false;
+   static long udp_idle_seconds = 30;
+
+   // Proxy-wide budget for forwarding memory in bytes (--maxmem,
+   // 0 = unlimited). The buffer and bridge pools account for every
+   // byte they hand out; once the rolled-up total exceeds the budget,
+   // flows already holding a backlog stop re-arming reads until their
+   // queued chunks drain, so slow-reading clients turn into TCP
+   // backpressure on their sources instead of proxy RSS growth.
+   static unsigned long long memory_budget_bytes = 0;
+
+   // Per-bridge cap on client-facing egress in bytes per second
+   // (--maxbps, 0 = unlimited). Keeps a single bulk transfer from
+   // starving interactive flows sharing the proxy.
+   static std::size_t downstream_bps = 0;
+
+   // Emit a HAProxy PROXY protocol v2 header on every upstream
+   // connection so backends see the real client address
+   // (--proxyproto). The header rides in front of the first client
+   // payload in one gathered write; enabling it costs no extra
+   // syscalls or round trips.
+   static bool proxy_protocol = false;
+
+   /*
+      TLS termination / re-origination (tcpproxy_server_tls build).
+      The bridge is a template over its two stream types, so the same
+      forwarding sections run over plain sockets or ssl::stream on
+      either side. The contexts live for the process and are shared by
+      every reactor; SSL object creation against a shared SSL_CTX is
+      thread safe.
+   */
+
+   #ifdef TCPPROXY_TLS
+   typedef asio::ssl::stream<ip::tcp::socket> tls_stream_type;
+
+   static bool tls_terminate = false; // client side speaks TLS
+   static bool tls_originate = false; // remote server side speaks TLS
+
+   static asio::ssl::context* tls_server_context = nullptr;
+   static asio::ssl::context* tls_client_context = nullptr;
+
+   // Most recent upstream session per reactor, offered on the next
+   // client handshake so resumption (or a ticket) skips the full key
+   // exchange. One slot is enough: all bridges of a reactor talk to
+   // the same small backend set.
+   static thread_local SSL_SESSION* tls_last_session = nullptr;
+   #endif
+
+   template <typename Stream>
+   struct stream_is_tls : std::false_type {};
+
+   #ifdef TCPPROXY_TLS
+   template <typename NextLayer>
+   struct stream_is_tls<asio::ssl::stream<NextLayer>> : std::true_type {};
+   #endif
+
+   // Seconds a resolved upstream endpoint is served from cache before
+   // being re-resolved (--dnsttl). The system resolver does not expose
+   // record TTLs, so a fixed refresh interval stands in for them.
+   static long dns_ttl_seconds = 30;
+
+   // Per-reactor cache of resolved upstream endpoints. Hostname
+   // targets are resolved asynchronously once per TTL window and the
+   // endpoints are shared by every bridge the reactor accepts; literal
+   // addresses are cached forever without touching the resolver. Every
+   // resolved address is kept (a dual-stack backend yields both
+   // families), so bridges can fail a connect over to an alternate.
+   // On a failed refresh the stale endpoints are served rather than
+   // failing the client connection.
+   class endpoint_cache
    {
    public:
 
-      typedef ip::tcp::socket socket_type;
-      typedef std::shared_ptr<bridge> ptr_type;
+      typedef std::function<void(const std::error_code&,
+                                 const std::vector<ip::tcp::endpoint>&)> handler_type;
 
-      bridge(asio::io_context& ios)
-      : downstream_socket_(ios),
-        upstream_socket_  (ios)
+      explicit endpoint_cache(asio::io_context& ios)
+      : resolver_(ios)
       {}
 
-      socket_type& downstream_socket()
+      void resolve(const std::string& host, const unsigned short port, handler_type handler)
       {
-         // Client socket
-         return downstream_socket_;
-      }
+         const std::string key = host + ':' + std::to_string(port);
 
-      socket_type& upstream_socket()
-      {
-         // Remote server socket
-         return upstream_socket_;
-      }
+         entry& e = cache_[key];
 
-      void start(const std::string& upstream_host, unsigned short upstream_port)
-      {
-         // Attempt connection to remote server (upstream side)
-         upstream_socket_.async_connect(
-              ip::tcp::endpoint(
-                   asio::ip::make_address(upstream_host),
-                   upstream_port),
-               std::bind(&bridge::handle_upstream_connect,
-                    shared_from_this(),
-                    std::placeholders::_1));
-      }
+         const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
 
-      void handle_upstream_connect(const std::error_code& error)
-      {
-         if (!error)
+         if (e.valid && (now < e.expiry))
          {
-            // Setup async read from remote server (upstream)
-            upstream_socket_.async_read_some(
-                 asio::buffer(upstream_data_,max_data_length),
-                 std::bind(&bridge::handle_upstream_read,
-                      shared_from_this(),
-                      std::placeholders::_1,
-                      std::placeholders::_2));
-
-            // Setup async read from client (downstream)
-            downstream_socket_.async_read_some(
-                 asio::buffer(downstream_data_,max_data_length),
-                 std::bind(&bridge::handle_downstream_read,
-                      shared_from_this(),
-                      std::placeholders::_1,
-                      std::placeholders::_2));
+            handler(std::error_code(),e.endpoints);
+            return;
          }
-         else
-            close();
+
+         e.waiters.push_back(std::move(handler));
+
+         if (e.resolving)
+            return;
+
+         // Literal addresses never expire and never hit the resolver
+         try
+         {
+            e.endpoints.assign(1,ip::tcp::endpoint(asio::ip::make_address(host),port));
+            e.valid  = true;
+            e.expiry = now + std::chrono::hours(24 * 365);
+            flush_waiters(e,std::error_code());
+            return;
+         }
+         catch(std::exception&)
+         {}
+
+         e.resolving = true;
+
+         resolver_.async_resolve(host,std::to_string(port),
+              [this, key](const std::error_code& error, ip::tcp::resolver::results_type results)
+              { handle_resolve(key,error,results); });
       }
 
    private:
 
-      /*
-         Section A: Remote Server --> Proxy --> Client
-         Process data recieved from remote sever then send to client.
-      */
+      struct entry
+      {
+         std::vector<ip::tcp::endpoint> endpoints;
+         std::chrono::steady_clock::time_point expiry;
+         bool valid     = false;
+         bool resolving = false;
+         std::vector<handler_type> waiters;
+      };
 
-      // Read from remote server complete, now send data to client
-      void handle_upstream_read(const std::error_code& error,
-                                const size_t& bytes_transferred)
+      void handle_resolve(const std::string& key,
+                          const std::error_code& error,
+                          const ip::tcp::resolver::results_type& results)
       {
-         if (!error)
+         entry& e = cache_[key];
+
+         e.resolving = false;
+
+         if (!error && !results.empty())
+         {
+            e.endpoints.clear();
+
+            for (ip::tcp::resolver::results_type::const_iterator it = results.begin();
+                 it != results.end(); ++it)
+            {
+               e.endpoints.push_back(it->endpoint());
+            }
+
+            e.valid  = true;
+            e.expiry = std::chrono::steady_clock::now() +
+                       std::chrono::seconds(dns_ttl_seconds);
+
+            flush_waiters(e,std::error_code());
+         }
+         else if (e.valid)
          {
-            async_write(downstream_socket_,
-                 asio::buffer(upstream_data_,bytes_transferred),
-                 std::bind(&bridge::handle_downstream_write,
-                      shared_from_this(),
-                      std::placeholders::_1));
+            // Refresh failed: serve the stale endpoints and try again
+            // after another TTL window.
+            e.expiry = std::chrono::steady_clock::now() +
+                       std::chrono::seconds(dns_ttl_seconds);
+
+            flush_waiters(e,std::error_code());
          }
          else
-            close();
+            flush_waiters(e,error ? error : std::error_code(asio::error::host_not_found));
       }
 
-      // Write to client complete, Async read from remote server
-      void handle_downstream_write(const std::error_code& error)
+      void flush_waiters(entry& e, const std::error_code& error)
       {
-         if (!error)
+         std::vector<handler_type> waiters;
+         waiters.swap(e.waiters);
+
+         for (std::size_t i = 0; i < waiters.size(); ++i)
          {
-            upstream_socket_.async_read_some(
-                 asio::buffer(upstream_data_,max_data_length),
-                 std::bind(&bridge::handle_upstream_read,
-                      shared_from_this(),
-                      std::placeholders::_1,
-                      std::placeholders::_2));
+            waiters[i](error,e.endpoints);
          }
-         else
-            close();
       }
-      // *** End Of Section A ***
 
+      ip::tcp::resolver resolver_;
+      std::unordered_map<std::string,entry> cache_;
+   };
 
-      /*
-         Section B: Client --> Proxy --> Remove Server
-         Process data recieved from client then write to remove server.
-      */
+   /*
+      Hot-path instrumentation. Every reactor owns one cache-line
+      padded counter block that only its own thread writes; the data
+      path therefore never touches a shared cache line. Writers use a
+      plain load/add/store on relaxed atomics (single writer per
+      block), readers aggregate on demand from the stats endpoint.
+   */
+
+   typedef std::atomic<unsigned long long> stat_counter;
+
+   inline void bump(stat_counter& counter, const unsigned long long n = 1)
+   {
+      counter.store(counter.load(std::memory_order_relaxed) + n,
+                    std::memory_order_relaxed);
+   }
+
+   inline void drop(stat_counter& counter, const unsigned long long n = 1)
+   {
+      counter.store(counter.load(std::memory_order_relaxed) - n,
+                    std::memory_order_relaxed);
+   }
+
+   struct alignas(64) reactor_counters
+   {
+      stat_counter a_bytes        {0}; // remote server --> client
+      stat_counter b_bytes        {0}; // client --> remote server
+      stat_counter a_ops          {0};
+      stat_counter b_ops          {0};
+      stat_counter accepts        {0};
+      stat_counter connect_errors {0};
+      stat_counter timeouts       {0};
+      stat_counter active_bridges {0};
+      stat_counter memory_bytes   {0}; // pool bytes currently on loan
+   };
+
+   enum { max_reactors = 256 };
+
+   static reactor_counters reactor_stats[max_reactors];
+
+   // Points at the owning reactor's counter block; set once per
+   // reactor thread before the io_context runs.
+   static thread_local reactor_counters* local_stats = nullptr;
+
+   // Memory checks against the --maxmem budget read a cached roll-up
+   // of the per-reactor loan counters; every rollup_interval checks
+   // the calling reactor re-sums the counters and republishes the
+   // figure. The data path therefore shares a counter line only once
+   // per interval, at the cost of the figure lagging by a bounded
+   // number of reads.
+   static std::atomic<unsigned long long> memory_in_use {0};
+
+   enum { memory_rollup_interval = 256 };
+
+   inline bool over_memory_budget()
+   {
+      if (0 == memory_budget_bytes)
+         return false;
 
-      // Read from client complete, now send data to remote server
-      void handle_downstream_read(const std::error_code& error,
-                                  const size_t& bytes_transferred)
+      static thread_local unsigned int checks_left = 0;
+
+      if (checks_left > 0)
       {
-         if (!error)
-         {
-            async_write(upstream_socket_,
-                  asio::buffer(downstream_data_,bytes_transferred),
-                  std::bind(&bridge::handle_upstream_write,
-                        shared_from_this(),
-                        std::placeholders::_1));
-         }
-         else
-            close();
+         --checks_left;
+
+         return memory_in_use.load(std::memory_order_relaxed) >
+                memory_budget_bytes;
+      }
+
+      checks_left = memory_rollup_interval - 1;
+
+      unsigned long long total = 0;
+
+      for (std::size_t i = 0; i < max_reactors; ++i)
+      {
+         total += reactor_stats[i].memory_bytes.load(std::memory_order_relaxed);
+      }
+
+      memory_in_use.store(total,std::memory_order_relaxed);
+
+      return total > memory_budget_bytes;
+   }
+
+   /*
+      Soak profiling (--profile <file>). Each reactor keeps a padded
+      counter block: completion handlers dispatched, pool hits and
+      misses, handler-arena spills, and a log2 histogram of loop lag
+      — how late the sampling timer's own handler ran past its
+      deadline, i.e. how long the reactor was busy with other work.
+      A background thread re-renders the whole report as JSON every
+      few seconds, so the file left behind when a soak run is stopped
+      is the exit report, at most one interval stale. Syscalls are
+      not traced directly; completed I/O operations stand in for
+      them, which undercounts only the kernel's speculative retries.
+   */
+
+   static std::string profile_file; // empty = profiling disabled
+
+   struct alignas(64) profile_counters
+   {
+      enum { lag_buckets = 22 }; // 1us up to ~4s, then clamped
+
+      stat_counter dispatches     {0}; // completion handlers run
+      stat_counter pool_hits      {0}; // buffer/bridge pool reuses
+      stat_counter pool_misses    {0}; // fell through to the allocator
+      stat_counter handler_spills {0}; // handler arena too small
+      stat_counter lag_samples    {0};
+      stat_counter lag[lag_buckets] {};
+   };
+
+   static profile_counters* profile_stats = nullptr; // one per reactor
+
+   // Points at the owning reactor's profile block; null unless
+   // --profile is active, so the hooks below cost one predictable
+   // branch when profiling is off.
+   static thread_local profile_counters* local_profile = nullptr;
+
+   inline void profile_lag(profile_counters& p, const unsigned long long usec)
+   {
+      unsigned int bucket = 0;
+
+      while (
+              ((1ull << (bucket + 1)) <= usec) &&
+              ((bucket + 1) < profile_counters::lag_buckets)
+            )
+      {
+         ++bucket;
       }
 
-      // Write to remote server complete, Async read from client
-      void handle_upstream_write(const std::error_code& error)
+      bump(p.lag[bucket]);
+      bump(p.lag_samples);
+   }
+
+   // Per-reactor pool of forwarding buffers, organised in power-of-four
+   // size classes from 4KB to 1MB. Reactors are single threaded, so no
+   // locking is required. Buffers are recycled through per-class free
+   // lists instead of being returned to the allocator.
+   class buffer_pool
+   {
+   public:
+
+      enum
       {
-         if (!error)
+         class_count     = 5,
+         min_buffer_size = 4096 //4KB
+      };
+
+      static std::size_t class_size(const std::size_t class_index)
+      {
+         // 4KB, 16KB, 64KB, 256KB, 1MB
+         return static_cast<std::size_t>(min_buffer_size) << (2 * class_index);
+      }
+
+      buffer_pool() = default;
+
+      buffer_pool(const buffer_pool&) = delete;
+      buffer_pool& operator=(const buffer_pool&) = delete;
+
+      ~buffer_pool()
+      {
+         for (std::size_t i = 0; i < class_count; ++i)
          {
-            downstream_socket_.async_read_some(
-                 asio::buffer(downstream_data_,max_data_length),
-                 std::bind(&bridge::handle_downstream_read,
-                      shared_from_this(),
-                      std::placeholders::_1,
-                      std::placeholders::_2));
+            for (std::size_t j = 0; j < free_list_[i].size(); ++j)
+            {
+               delete[] free_list_[i][j];
+            }
          }
-         else
-            close();
       }
-      // *** End Of Section B ***
 
-      void close()
+      unsigned char* acquire(const std::size_t class_index)
       {
-         std::scoped_lock lock(mutex_);
+         if (local_stats)
+         {
+            bump(local_stats->memory_bytes,class_size(class_index));
+         }
 
-         if (downstream_socket_.is_open())
+         std::vector<unsigned char*>& free_list = free_list_[class_index];
+
+         if (!free_list.empty())
          {
-            downstream_socket_.close();
+            if (local_profile)
+            {
+               bump(local_profile->pool_hits);
+            }
+
+            unsigned char* data = free_list.back();
+            free_list.pop_back();
+            return data;
          }
 
-         if (upstream_socket_.is_open())
+         if (local_profile)
          {
-            upstream_socket_.close();
+            bump(local_profile->pool_misses);
          }
+
+         return new unsigned char[class_size(class_index)];
       }
 
-      socket_type downstream_socket_;
-      socket_type upstream_socket_;
+      void release(const std::size_t class_index, unsigned char* data)
+      {
+         if (local_stats)
+         {
+            drop(local_stats->memory_bytes,class_size(class_index));
+         }
+
+         free_list_[class_index].push_back(data);
+      }
 
-      enum { max_data_length = 8192 }; //8KB
-      unsigned char downstream_data_[max_data_length];
-      unsigned char upstream_data_  [max_data_length];
+   private:
 
-      std::mutex mutex_;
+      std::vector<unsigned char*> free_list_[class_count];
+   };
 
+   // Recycles the fixed-size chunk that std::allocate_shared requests
+   // for a bridge (object plus shared_ptr control block in a single
+   // allocation), so steady-state accepts never touch the allocator.
+   // Like the buffer pool this is per-reactor and needs no locking.
+   class object_pool
+   {
    public:
 
-      class acceptor
+      object_pool() = default;
+
+      object_pool(const object_pool&) = delete;
+      object_pool& operator=(const object_pool&) = delete;
+
+      ~object_pool()
       {
-      public:
+         for (std::size_t i = 0; i < free_chunks_.size(); ++i)
+         {
+            ::operator delete(free_chunks_[i]);
+         }
+      }
 
-         acceptor(asio::io_context& io_service,
-                  const std::string& local_host, unsigned short local_port,
-                  const std::string& upstream_host, unsigned short upstream_port)
-         : io_service_(io_service),
-           localhost_address(asio::ip::make_address_v4(local_host)),
-           acceptor_(io_service_,ip::tcp::endpoint(localhost_address,local_port)),
-           upstream_port_(upstream_port),
-           upstream_host_(upstream_host)
-         {}
+      void* allocate(const std::size_t size)
+      {
+         if (local_stats)
+         {
+            bump(local_stats->memory_bytes,size);
+         }
 
-         bool accept_connections()
+         if (chunk_size_ == 0)
          {
-            try
-            {
-               session_ = std::shared_ptr<bridge>(new bridge(io_service_));
+            chunk_size_ = size;
+         }
 
-               acceptor_.async_accept(session_->downstream_socket(),
-                    std::bind(&acceptor::handle_accept,
-                         this,
-                         std::placeholders::_1));
-            }
-            catch(std::exception& e)
+         if ((size == chunk_size_) && !free_chunks_.empty())
+         {
+            if (local_profile)
             {
-               std::cerr << "acceptor exception: " << e.what() << std::endl;
-               return false;
+               bump(local_profile->pool_hits);
             }
 
-            return true;
+            void* chunk = free_chunks_.back();
+            free_chunks_.pop_back();
+            return chunk;
          }
 
-      private:
+         if (local_profile)
+         {
+            bump(local_profile->pool_misses);
+         }
 
-         void handle_accept(const std::error_code& error)
+         return ::operator new(size);
+      }
+
+      void deallocate(void* chunk, const std::size_t size)
+      {
+         if (local_stats)
          {
-            if (!error)
-            {
-               session_->start(upstream_host_,upstream_port_);
+            drop(local_stats->memory_bytes,size);
+         }
 
-               if (!accept_connections())
-               {
-                  std::cerr << "Failure during call to accept." << std::endl;
-               }
-            }
-            else
-            {
-               std::cerr << "Error: " << error.message() << std::endl;
-            }
+         if (size == chunk_size_)
+         {
+            free_chunks_.push_back(chunk);
          }
+         else
+            ::operator delete(chunk);
+      }
 
-         asio::io_context& io_service_;
-         ip::address_v4 localhost_address;
-         ip::tcp::acceptor acceptor_;
-         ptr_type session_;
-         unsigned short upstream_port_;
-         std::string upstream_host_;
-      };
+   private:
 
+      std::size_t chunk_size_ = 0;
+      std::vector<void*> free_chunks_;
    };
-}
 
-int main(int argc, char* argv[])
-{
-   if (argc != 5)
+   template <typename T>
+   class recycling_allocator
    {
-      std::cerr << "usage: tcpproxy_server <local host ip> <local port> <forward host ip> <forward port>" << std::endl;
-      return 1;
-   }
+   public:
 
-   const unsigned short local_port   = static_cast<unsigned short>(::atoi(argv[2]));
-   const unsigned short forward_port = static_cast<unsigned short>(::atoi(argv[4]));
-   const std::string local_host      = argv[1];
-   const std::string forward_host    = argv[3];
+      typedef T value_type;
 
-   asio::io_context ios;
+      explicit recycling_allocator(object_pool& pool)
+      : pool_(&pool)
+      {}
 
-   try
-   {
-      tcp_proxy::bridge::acceptor acceptor(ios,
-                                           local_host, local_port,
-                                           forward_host, forward_port);
+      template <typename U>
+      recycling_allocator(const recycling_allocator<U>& other)
+      : pool_(other.pool_)
+      {}
 
-      acceptor.accept_connections();
+      T* allocate(const std::size_t n)
+      {
+         return static_cast<T*>(pool_->allocate(n * sizeof(T)));
+      }
 
-      ios.run();
-   }
-   catch(std::exception& e)
+      void deallocate(T* p, const std::size_t n)
+      {
+         pool_->deallocate(p,n * sizeof(T));
+      }
+
+      template <typename U>
+      bool operator==(const recycling_allocator<U>& other) const
+      {
+         return pool_ == other.pool_;
+      }
+
+      template <typename U>
+      bool operator!=(const recycling_allocator<U>& other) const
+      {
+         return pool_ != other.pool_;
+      }
+
+      object_pool* pool_;
+   };
+
+   // One direction's leased buffer. Grows a size class after a streak
+   // of reads that filled the buffer (bulk flow), shrinks after a
+   // streak of reads that would comfortably fit a smaller class, so
+   // mostly idle keepalive connections fall back to 4KB.
+   class leased_buffer
    {
-      std::cerr << "Error: " << e.what() << std::endl;
-      return 1;
+   public:
+
+      leased_buffer() = default;
+
+      leased_buffer(const leased_buffer&) = delete;
+      leased_buffer& operator=(const leased_buffer&) = delete;
+
+      ~leased_buffer()
+      {
+         release();
+      }
+
+      void lease(buffer_pool& pool)
+      {
+         pool_         = &pool;
+         class_index_  = 0;
+         data_         = pool.acquire(class_index_);
+         full_streak_  = 0;
+         small_streak_ = 0;
+      }
+
+      void release()
+      {
+         if (data_)
+         {
+            pool_->release(class_index_,data_);
+            data_ = nullptr;
+         }
+      }
+
+      unsigned char* data() const { return data_; }
+
+      std::size_t size() const { return buffer_pool::class_size(class_index_); }
+
+      // Called once the bytes of the previous read have been fully
+      // forwarded, i.e. when the buffer is free to be resized.
+      void note_read(const std::size_t bytes)
+      {
+         if (bytes == size())
+         {
+            small_streak_ = 0;
+
+            if (
+                 (++full_streak_ >= grow_streak) &&
+                 ((class_index_ + 1) < buffer_pool::class_count)
+               )
+            {
+               resize(class_index_ + 1);
+            }
+         }
+         else
+         {
+            full_streak_ = 0;
+
+            if (
+                 (class_index_ > 0) &&
+                 (bytes <= (buffer_pool::class_size(class_index_ - 1) / 2))
+               )
+            {
+               if (++small_streak_ >= shrink_streak)
+               {
+                  resize(class_index_ - 1);
+               }
+            }
+            else
+               small_streak_ = 0;
+         }
+      }
+
+   private:
+
+      enum
+      {
+         grow_streak   = 4,
+         shrink_streak = 16
+      };
+
+      void resize(const std::size_t class_index)
+      {
+         pool_->release(class_index_,data_);
+         class_index_  = class_index;
+         data_         = pool_->acquire(class_index_);
+         full_streak_  = 0;
+         small_streak_ = 0;
+      }
+
+      buffer_pool* pool_         = nullptr;
+      unsigned char* data_       = nullptr;
+      std::size_t class_index_   = 0;
+      unsigned int full_streak_  = 0;
+      unsigned int small_streak_ = 0;
+   };
+
+   /*
+      Per-flow reporting (--flowlog). Every bridge keeps a fixed-size
+      record — peer address, bytes per direction, connect time and a
+      log2-bucketed histogram of read-to-write-complete forwarding
+      latency — updated inline with no allocation. On teardown the
+      record is pushed onto the owning reactor's single-producer
+      single-consumer ring, and a background thread drains the rings
+      into the log file, one line per closed flow. A full ring drops
+      the record rather than stall the reactor.
+   */
+
+   static std::string flow_log_file; // empty = reporting disabled
+
+   struct flow_report
+   {
+      enum { latency_buckets = 22 }; // 1us up to ~4s, then clamped
+
+      char peer[64]                = { 0 };
+      unsigned long long a_bytes   = 0; // remote server --> client
+      unsigned long long b_bytes   = 0; // client --> remote server
+      unsigned long long samples   = 0;
+      unsigned int latency[latency_buckets] = { 0 };
+      unsigned int connect_usec    = 0;
+      unsigned int duration_msec   = 0;
+
+      void sample(const unsigned long long usec)
+      {
+         unsigned int bucket = 0;
+
+         while (
+                 ((1ull << (bucket + 1)) <= usec) &&
+                 ((bucket + 1) < latency_buckets)
+               )
+         {
+            ++bucket;
+         }
+
+         ++latency[bucket];
+         ++samples;
+      }
+
+      // Upper bound in microseconds of the bucket holding the p'th
+      // sample; good to a factor of two, which is all "which flows
+      // are slow" needs.
+      unsigned long long percentile(const double p) const
+      {
+         const unsigned long long rank =
+            static_cast<unsigned long long>(p * (samples - 1));
+
+         unsigned long long seen = 0;
+
+         for (unsigned int i = 0; i < latency_buckets; ++i)
+         {
+            seen += latency[i];
+
+            if (seen > rank)
+            {
+               return (1ull << (i + 1));
+            }
+         }
+
+         return (1ull << latency_buckets);
+      }
+   };
+
+   // Single-producer single-consumer ring of fixed-size records; the
+   // producer is always the owning reactor thread, the consumer a
+   // background logger thread.
+   template <typename T>
+   class report_ring
+   {
+   public:
+
+      enum { capacity = 128 };
+
+      // Producer side, called on the owning reactor thread only.
+      bool push(const T& report)
+      {
+         const std::size_t head = head_.load(std::memory_order_relaxed);
+
+         if ((head - tail_.load(std::memory_order_acquire)) == capacity)
+         {
+            return false; // full: drop, never stall the reactor
+         }
+
+         slot_[head % capacity] = report;
+         head_.store(head + 1,std::memory_order_release);
+
+         return true;
+      }
+
+      // Consumer side, called on the logger thread only.
+      bool pop(T& report)
+      {
+         const std::size_t tail = tail_.load(std::memory_order_relaxed);
+
+         if (head_.load(std::memory_order_acquire) == tail)
+         {
+            return false;
+         }
+
+         report = slot_[tail % capacity];
+         tail_.store(tail + 1,std::memory_order_release);
+
+         return true;
+      }
+
+   private:
+
+      T slot_[capacity];
+
+      std::atomic<std::size_t> head_ { 0 };
+      std::atomic<std::size_t> tail_ { 0 };
+   };
+
+   typedef report_ring<flow_report> flow_report_ring;
+
+   // Allocated in main() for the actual reactor count when --flowlog
+   // is given; null otherwise.
+   static flow_report_ring* flow_report_rings = nullptr;
+
+   static thread_local flow_report_ring* local_flow_ring = nullptr;
+
+   /*
+      Binary access log (--accesslog). One fixed-size record per
+      closed connection — peer, backend, byte totals, duration and
+      close reason — appended to the reactor's ring for the cost of a
+      memcpy; a writer thread batches the rings to disk. The on-disk
+      layout lives in tcpproxy_accesslog.hpp, shared with the
+      tcpproxy_logcat converter.
+   */
+
+   static std::string access_log_file; // empty = disabled
+
+   typedef report_ring<access_record> access_record_ring;
+
+   static access_record_ring* access_log_rings = nullptr;
+
+   static thread_local access_record_ring* local_access_ring = nullptr;
+
+   /*
+      Shared throttle clock. Bridges that have exhausted their egress
+      token bucket park themselves here instead of each arming a
+      private timer; one coarse steady_timer per reactor wakes the
+      whole batch every tick. The timer is armed only while at least
+      one bridge is waiting, so an unthrottled reactor never ticks.
+   */
+
+   class throttle_clock
+   {
+   public:
+
+      enum { tick_msec = 20 };
+
+      // Waiters are registered type-erased (the bridge is a class
+      // template) as an object pointer plus a wake thunk.
+      struct waiter
+      {
+         void* self;
+         void (*wake)(void*);
+      };
+
+      explicit throttle_clock(asio::io_context& ios)
+      : timer_(ios)
+      {}
+
+      void wait(void* self, void (*wake)(void*))
+      {
+         waiters_.push_back(waiter{self,wake});
+
+         if (!armed_)
+         {
+            armed_ = true;
+            arm();
+         }
+      }
+
+   private:
+
+      void arm()
+      {
+         timer_.expires_after(std::chrono::milliseconds(
+                                 static_cast<long>(tick_msec)));
+         timer_.async_wait([this](const std::error_code& error)
+              { handle_tick(error); });
+      }
+
+      void handle_tick(const std::error_code&)
+      {
+         // Waiters are woken even on a cancelled wait: every parked
+         // bridge carries a pending-operation count that must unwind.
+         // The list is swapped before running so that bridges
+         // re-parking themselves land on the next tick rather than
+         // being woken twice in one pass.
+         running_.swap(waiters_);
+
+         for (std::size_t i = 0; i < running_.size(); ++i)
+         {
+            running_[i].wake(running_[i].self);
+         }
+
+         running_.clear();
+
+         if (!waiters_.empty())
+            arm();
+         else
+            armed_ = false;
+      }
+
+      asio::steady_timer timer_;
+      std::vector<waiter> waiters_;
+      std::vector<waiter> running_;
+      bool armed_ = false;
+   };
+
+   // Points at the owning reactor's throttle clock; set once per
+   // reactor thread before the io_context runs.
+   static thread_local throttle_clock* local_throttle = nullptr;
+
+   // Connection timeouts in seconds (--connecttimeout, --idletimeout,
+   // --writetimeout; 0 disables the respective check).
+   static long connect_timeout_seconds = 0;
+   static long idle_timeout_seconds    = 0;
+   static long write_timeout_seconds   = 0;
+
+   // A failed upstream connect fails over to the backend's next
+   // resolved address immediately; once every address has failed the
+   // walk restarts, up to --retries more rounds under exponential
+   // wheel-tick backoff. 0 disables retrying; --connecttimeout still
+   // bounds the total however many rounds run.
+   static unsigned int connect_retry_limit = 2;
+
+   /*
+      Timer wheel. Tracks one deadline per intrusive entry in coarse
+      half-second ticks: arming, re-arming and cancelling are pointer
+      splices into a slot ring, O(1) regardless of how many bridges are
+      tracked, and a single shared steady_timer per reactor advances
+      the wheel. A per-bridge steady_timer would put every re-arm
+      through the io_context's timer queue; at one re-arm per read
+      completion that is exactly the kind of work this avoids.
+   */
+
+   class timer_wheel
+   {
+   public:
+
+      enum
+      {
+         tick_msec  = 500,
+         wheel_size = 1024 // must exceed the longest timeout in ticks
+      };
+
+      struct entry
+      {
+         entry* prev = nullptr;
+         entry* next = nullptr;
+
+         unsigned long deadline = 0;
+
+         void* self            = nullptr;
+         void (*expire)(void*) = nullptr;
+
+         bool linked() const
+         {
+            return prev != nullptr;
+         }
+      };
+
+      explicit timer_wheel(asio::io_context& ios)
+      : timer_(ios)
+      {
+         for (std::size_t i = 0; i < wheel_size; ++i)
+         {
+            slot_[i].prev = &slot_[i];
+            slot_[i].next = &slot_[i];
+         }
+
+         expired_.prev = &expired_;
+         expired_.next = &expired_;
+      }
+
+      static unsigned long ticks(const long seconds)
+      {
+         return static_cast<unsigned long>(seconds) * (1000 / tick_msec);
+      }
+
+      void arm(entry& e, const unsigned long ticks_from_now)
+      {
+         // A refresh moves an entry that is already counted; only a
+         // first arm may grow armed_count_, or it never drains back
+         // to zero and the tick timer runs forever.
+         if (e.linked())
+         {
+            --armed_count_;
+         }
+
+         unlink(e);
+
+         e.deadline = now_tick_ + ticks_from_now;
+
+         link(slot_[e.deadline % wheel_size],e);
+
+         ++armed_count_;
+
+         if (!running_)
+         {
+            running_ = true;
+            schedule();
+         }
+      }
+
+      void cancel(entry& e)
+      {
+         if (e.linked())
+         {
+            unlink(e);
+            --armed_count_;
+         }
+      }
+
+   private:
+
+      static void link(entry& list, entry& e)
+      {
+         e.prev           = list.prev;
+         e.next           = &list;
+         list.prev->next  = &e;
+         list.prev        = &e;
+      }
+
+      static void unlink(entry& e)
+      {
+         if (e.prev)
+         {
+            e.prev->next = e.next;
+            e.next->prev = e.prev;
+            e.prev       = nullptr;
+            e.next       = nullptr;
+         }
+      }
+
+      void schedule()
+      {
+         timer_.expires_after(std::chrono::milliseconds(
+                                 static_cast<long>(tick_msec)));
+         timer_.async_wait([this](const std::error_code& error)
+              { advance(error); });
+      }
+
+      void advance(const std::error_code& error)
+      {
+         if (error)
+         {
+            running_ = false;
+            return;
+         }
+
+         ++now_tick_;
+
+         // Due entries move to a private list before firing: an expiry
+         // callback may cancel (unlink) any entry, including ones
+         // already pulled off the slot, and unlink works from either
+         // list.
+         entry& slot = slot_[now_tick_ % wheel_size];
+
+         for (entry* e = slot.next; e != &slot; )
+         {
+            entry* next = e->next;
+
+            if (e->deadline <= now_tick_)
+            {
+               // Still counted as armed while parked here, so that a
+               // cancel() from a callback stays balanced.
+               unlink(*e);
+               link(expired_,*e);
+            }
+
+            e = next;
+         }
+
+         while (expired_.next != &expired_)
+         {
+            entry* e = expired_.next;
+            unlink(*e);
+            --armed_count_;
+            e->expire(e->self);
+         }
+
+         if (armed_count_ > 0)
+            schedule();
+         else
+            running_ = false;
+      }
+
+      asio::steady_timer timer_;
+      entry slot_[wheel_size];
+      entry expired_;
+      unsigned long now_tick_    = 0;
+      std::size_t armed_count_   = 0;
+      bool running_              = false;
+   };
+
+   // Points at the owning reactor's timer wheel; set once per reactor
+   // thread before the io_context runs.
+   static thread_local timer_wheel* local_wheel = nullptr;
+
+   // Socket tuning applied to both sides of every bridge. All options
+   // default to the kernel's own defaults; latency-critical
+   // deployments opt in at startup (--nodelay, --keepalive,
+   // --sndbuf/--rcvbuf, --fastopen).
+   struct socket_tuning
+   {
+      bool nodelay   = false;
+      bool keepalive = false;
+      int sndbuf     = 0; // 0 = kernel default
+      int rcvbuf     = 0;
+      int fastopen   = 0; // listen-side pending-SYN queue length
+   };
+
+   static socket_tuning tuning;
+
+   static void tune_socket(ip::tcp::socket& socket)
+   {
+      // Tuning is best effort: a socket that rejects an option still
+      // forwards traffic.
+      try
+      {
+         if (tuning.nodelay)
+         {
+            socket.set_option(ip::tcp::no_delay(true));
+         }
+
+         if (tuning.keepalive)
+         {
+            socket.set_option(asio::socket_base::keep_alive(true));
+         }
+
+         if (tuning.sndbuf > 0)
+         {
+            socket.set_option(asio::socket_base::send_buffer_size(tuning.sndbuf));
+         }
+
+         if (tuning.rcvbuf > 0)
+         {
+            socket.set_option(asio::socket_base::receive_buffer_size(tuning.rcvbuf));
+         }
+      }
+      catch(std::exception& e)
+      {
+         std::cerr << "warning: socket tuning: " << e.what() << std::endl;
+      }
+   }
+
+   // Upstream selection policy for multi-backend targets (--balance).
+   enum class balance_policy
+   {
+      round_robin,
+      least_connections,
+      ewma_latency
+   };
+
+   static balance_policy upstream_policy = balance_policy::round_robin;
+
+   // The set of upstream backends one acceptor spreads bridges across,
+   // plus the per-backend load state the selection policies consume.
+   // Live per-reactor like the pools, so updates from the data path
+   // are plain stores.
+   class backend_set
+   {
+   public:
+
+      struct backend
+      {
+         std::string host;
+         unsigned short port = 0;
+         std::size_t active  = 0; // bridges currently open
+         double ewma_usec    = 0; // smoothed connect latency
+      };
+
+      void add(const std::string& host, const unsigned short port)
+      {
+         backend b;
+         b.host = host;
+         b.port = port;
+         backends_.push_back(b);
+      }
+
+      std::size_t size() const { return backends_.size(); }
+
+      backend& at(const std::size_t index) { return backends_[index]; }
+
+      std::size_t select()
+      {
+         switch (upstream_policy)
+         {
+            case balance_policy::least_connections : return select_least_connections();
+            case balance_policy::ewma_latency      : return select_ewma_latency();
+            default                                : return next_++ % backends_.size();
+         }
+      }
+
+      void note_opened(const std::size_t index)
+      {
+         ++backends_[index].active;
+      }
+
+      void note_closed(const std::size_t index)
+      {
+         --backends_[index].active;
+      }
+
+      void note_connect_latency(const std::size_t index, const double usec)
+      {
+         backend& b = backends_[index];
+         b.ewma_usec = (b.ewma_usec == 0) ? usec : ((0.8 * b.ewma_usec) + (0.2 * usec));
+      }
+
+   private:
+
+      std::size_t select_least_connections()
+      {
+         std::size_t best = next_++ % backends_.size(); // rotate ties
+
+         for (std::size_t i = 0; i < backends_.size(); ++i)
+         {
+            if (backends_[i].active < backends_[best].active)
+               best = i;
+         }
+
+         return best;
+      }
+
+      std::size_t select_ewma_latency()
+      {
+         // Latency weighted by queue depth; a backend that has never
+         // been measured scores zero and is explored first.
+         std::size_t best  = next_++ % backends_.size();
+         double best_score = backends_[best].ewma_usec * (backends_[best].active + 1);
+
+         for (std::size_t i = 0; i < backends_.size(); ++i)
+         {
+            const double score = backends_[i].ewma_usec * (backends_[i].active + 1);
+
+            if (score < best_score)
+            {
+               best       = i;
+               best_score = score;
+            }
+         }
+
+         return best;
+      }
+
+      std::vector<backend> backends_;
+      std::size_t next_ = 0;
+   };
+
+   // Parses "<host>[:port][,<host>[:port]]..." into a backend set;
+   // entries without an explicit port use default_port. IPv6 literals
+   // take the usual bracketed "[::1]:port" form.
+   static void parse_backend_list(const std::string& spec,
+                                  const unsigned short default_port,
+                                  backend_set& backends)
+   {
+      std::size_t begin = 0;
+
+      while (begin <= spec.size())
+      {
+         std::size_t end = spec.find(',',begin);
+
+         if (end == std::string::npos)
+            end = spec.size();
+
+         const std::string token = spec.substr(begin,end - begin);
+
+         if (!token.empty())
+         {
+            std::string host    = token;
+            unsigned short port = default_port;
+
+            std::size_t colon = std::string::npos;
+
+            if (token[0] == '[')
+            {
+               const std::size_t bracket = token.find(']');
+
+               if (bracket != std::string::npos)
+               {
+                  host  = token.substr(1,bracket - 1);
+                  colon = token.find(':',bracket);
+               }
+            }
+            else if (token.find(':') == token.rfind(':')) // at most one ':'
+               colon = token.find(':');
+
+            if (colon != std::string::npos)
+            {
+               if (token[0] != '[')
+               {
+                  host = token.substr(0,colon);
+               }
+
+               port = static_cast<unsigned short>(::atoi(token.substr(colon + 1).c_str()));
+            }
+
+            backends.add(host,port);
+         }
+
+         begin = end + 1;
+      }
+   }
+
+   /*
+      Hot-reloadable upstream configuration (--config / SIGHUP). The
+      file's 'upstream' directive is published under a generation
+      counter; each reactor's acceptor notices the bump on its next
+      accept and builds a fresh backend set for new bridges, while
+      bridges already forwarding keep their old set untouched.
+   */
+
+   static std::string config_file;
+
+   static std::mutex upstream_spec_mutex;
+   static std::string upstream_spec;
+   static std::atomic<unsigned long> upstream_generation {1};
+
+   static std::string snapshot_upstream_spec()
+   {
+      std::scoped_lock lock(upstream_spec_mutex);
+      return upstream_spec;
+   }
+
+   // Re-reads the config file. Returns true when an upstream
+   // directive was found and published; on any failure the running
+   // configuration is left as-is.
+   static bool load_config_file()
+   {
+      std::ifstream file(config_file.c_str());
+
+      if (!file)
+      {
+         std::cerr << "Error: config: cannot open " << config_file << std::endl;
+         return false;
+      }
+
+      std::string spec;
+      std::string line;
+
+      while (std::getline(file,line))
+      {
+         const std::size_t comment = line.find('#');
+
+         if (comment != std::string::npos)
+         {
+            line.erase(comment);
+         }
+
+         std::size_t begin = line.find_first_not_of(" \t");
+
+         if (begin == std::string::npos)
+            continue;
+
+         const std::size_t end = line.find_last_not_of(" \t\r");
+
+         line = line.substr(begin,end - begin + 1);
+
+         static const std::string directive = "upstream";
+
+         if (
+              (line.compare(0,directive.size(),directive) == 0) &&
+              (line.size() > directive.size())
+            )
+         {
+            begin = line.find_first_not_of(" \t",directive.size());
+
+            if (begin != std::string::npos)
+            {
+               spec = line.substr(begin);
+            }
+         }
+      }
+
+      if (spec.empty())
+      {
+         std::cerr << "Error: config: no upstream directive in " << config_file << std::endl;
+         return false;
+      }
+
+      {
+         std::scoped_lock lock(upstream_spec_mutex);
+
+         if (spec == upstream_spec)
+            return true; // unchanged, no need to churn the reactors
+
+         upstream_spec = spec;
+      }
+
+      upstream_generation.fetch_add(1,std::memory_order_release);
+
+      std::cerr << "upstream configuration now: " << spec << std::endl;
+
+      return true;
+   }
+
+   // Fixed per-bridge storage for asio completion handlers (the asio
+   // custom allocation pattern). Each I/O chain owns one slot sized for
+   // the largest handler it binds; an occupied or undersized slot falls
+   // back to the heap, so this is purely an optimisation.
+   class handler_memory
+   {
+   public:
+
+      handler_memory()
+      : in_use_(false)
+      {}
+
+      handler_memory(const handler_memory&) = delete;
+      handler_memory& operator=(const handler_memory&) = delete;
+
+      void* allocate(const std::size_t size)
+      {
+         if (!in_use_ && (size <= sizeof(storage_)))
+         {
+            in_use_ = true;
+            return &storage_;
+         }
+
+         if (local_profile)
+         {
+            bump(local_profile->handler_spills);
+         }
+
+         return ::operator new(size);
+      }
+
+      void deallocate(void* pointer)
+      {
+         if (pointer == &storage_)
+         {
+            in_use_ = false;
+         }
+         else
+            ::operator delete(pointer);
+      }
+
+   private:
+
+      alignas(alignof(std::max_align_t)) unsigned char storage_[512];
+      bool in_use_;
+   };
+
+   template <typename T>
+   class handler_allocator
+   {
+   public:
+
+      typedef T value_type;
+
+      explicit handler_allocator(handler_memory& memory)
+      : memory_(&memory)
+      {}
+
+      template <typename U>
+      handler_allocator(const handler_allocator<U>& other)
+      : memory_(other.memory_)
+      {}
+
+      T* allocate(const std::size_t n)
+      {
+         return static_cast<T*>(memory_->allocate(n * sizeof(T)));
+      }
+
+      void deallocate(T* p, const std::size_t)
+      {
+         memory_->deallocate(p);
+      }
+
+      template <typename U>
+      bool operator==(const handler_allocator<U>& other) const
+      {
+         return memory_ == other.memory_;
+      }
+
+      template <typename U>
+      bool operator!=(const handler_allocator<U>& other) const
+      {
+         return memory_ != other.memory_;
+      }
+
+      handler_memory* memory_;
+   };
+
+   /*
+      Transfer policies. Optional per-chunk features — the egress
+      throttle, the PROXY header prefix and per-flow report sampling
+      — are compile-time properties of the bridge: under a policy
+      that disables them they are not branches that test false on
+      every chunk, they are absent from the instruction stream.
+      run_reactor() picks the variant once at startup; the dominant
+      plain configuration runs the minimal_transfer instantiation,
+      any deployment enabling one of the features the full_transfer
+      one.
+   */
+
+   struct minimal_transfer
+   {
+      enum
+      {
+         throttled = false, // --maxbps egress token bucket
+         prefixed  = false, // --proxyproto header prefix
+         reported  = false  // --flowlog / --accesslog sampling
+      };
+   };
+
+   struct full_transfer
+   {
+      enum
+      {
+         throttled = true,
+         prefixed  = true,
+         reported  = true
+      };
+   };
+
+   // The stream types are template parameters so the forwarding
+   // sections below compile once against plain sockets and once
+   // against ssl::stream for each enabled TLS side, with no virtual
+   // dispatch or branches on the data path.
+   template <typename DownStream      = ip::tcp::socket,
+             typename UpStream        = ip::tcp::socket,
+             typename TransferPolicy  = full_transfer>
+   class bridge : public std::enable_shared_from_this<bridge<DownStream,UpStream,TransferPolicy>>
+   {
+   public:
+
+      typedef ip::tcp::socket socket_type;
+      typedef std::shared_ptr<bridge> ptr_type;
+
+      bridge(asio::io_context& ios, buffer_pool& pool)
+      : downstream_socket_(make_stream<DownStream>(ios,true )),
+        upstream_socket_  (make_stream<UpStream>  (ios,false)),
+        pool_             (pool),
+        stats_            (local_stats),
+        throttle_         (local_throttle),
+        wheel_            (local_wheel),
+        flow_ring_        (local_flow_ring),
+        access_ring_      (local_access_ring)
+      {
+         activity_timer_.self   = this;
+         activity_timer_.expire = [](void* self)
+            { static_cast<bridge*>(self)->handle_timeout(); };
+
+         write_timer_.self      = this;
+         write_timer_.expire    = [](void* self)
+            { static_cast<bridge*>(self)->handle_timeout(); };
+
+         retry_timer_.self      = this;
+         retry_timer_.expire    = [](void* self)
+            { static_cast<bridge*>(self)->retry_connect(); };
+      }
+
+      ~bridge()
+      {
+         if (wheel_)
+         {
+            wheel_->cancel(activity_timer_);
+            wheel_->cancel(write_timer_);
+            wheel_->cancel(retry_timer_);
+         }
+
+         // Destruction always runs on the owning reactor thread, so
+         // this is the single-producer side of the report rings.
+         if ((flow_ring_ || access_ring_) && self_counted_)
+         {
+            const unsigned int duration_msec =
+               static_cast<unsigned int>(
+                  std::chrono::duration_cast<std::chrono::milliseconds>(
+                     std::chrono::steady_clock::now() - open_time_).count());
+
+            if (flow_ring_)
+            {
+               report_.duration_msec = duration_msec;
+
+               flow_ring_->push(report_);
+            }
+
+            if (access_ring_)
+            {
+               access_.a_bytes       = report_.a_bytes;
+               access_.b_bytes       = report_.b_bytes;
+               access_.duration_msec = duration_msec;
+
+               access_ring_->push(access_);
+            }
+         }
+
+         if (owner_)
+         {
+            owner_->bridge_closed();
+         }
+
+         // Only bridges that actually started are counted; the
+         // acceptor pre-constructs one bridge per pending accept.
+         if (stats_ && self_counted_)
+         {
+            drop(stats_->active_bridges);
+         }
+
+         if (backends_)
+         {
+            backends_->note_closed(backend_index_);
+         }
+
+         #ifdef __linux__
+         close_splice(upstream_channel_  );
+         close_splice(downstream_channel_);
+         #endif
+      }
+
+      class acceptor;
+
+      // Ties the bridge back to its accepting acceptor so closing can
+      // release a slot under the concurrency cap.
+      void set_owner(acceptor& owner)
+      {
+         owner_ = &owner;
+      }
+
+      // Associate this bridge with the backend the balancer selected;
+      // load accounting runs from here until the bridge is destroyed.
+      void set_backend(backend_set& backends, const std::size_t index)
+      {
+         backends_      = &backends;
+         backend_index_ = index;
+
+         backends.note_opened(index);
+
+         if (access_ring_)
+         {
+            const backend_set::backend& backend = backends.at(index);
+
+            std::snprintf(access_.backend,sizeof(access_.backend),
+                          "%s:%u",
+                          backend.host.c_str(),
+                          static_cast<unsigned int>(backend.port));
+         }
+      }
+
+      socket_type& downstream_socket()
+      {
+         // Client socket
+         return raw_socket(downstream_socket_);
+      }
+
+      socket_type& upstream_socket()
+      {
+         // Remote server socket
+         return raw_socket(upstream_socket_);
+      }
+
+      void start(const std::vector<ip::tcp::endpoint>& upstream_endpoints)
+      {
+         // The bridge keeps itself alive through self_ for as long as
+         // any handler is outstanding; individual handlers carry only
+         // a raw pointer and never touch the reference count.
+         self_ = this->shared_from_this();
+
+         candidate_count_ =
+            std::min<std::size_t>(upstream_endpoints.size(),max_candidates);
+
+         for (std::size_t i = 0; i < candidate_count_; ++i)
+         {
+            candidates_[i] = upstream_endpoints[i];
+         }
+
+         open_time_ = std::chrono::steady_clock::now();
+
+         if (access_ring_)
+         {
+            access_.open_unix_msec =
+               static_cast<unsigned long long>(
+                  std::chrono::duration_cast<std::chrono::milliseconds>(
+                     std::chrono::system_clock::now().time_since_epoch()).count());
+         }
+
+         if (stats_)
+         {
+            bump(stats_->active_bridges);
+            self_counted_ = true;
+         }
+
+         // One deadline covers connect establishment (and any TLS
+         // handshakes); start_forwarding() converts it to the idle
+         // deadline.
+         if (wheel_ && (connect_timeout_seconds > 0))
+         {
+            wheel_->arm(activity_timer_,
+                        timer_wheel::ticks(connect_timeout_seconds));
+         }
+
+         #ifdef TCPPROXY_TLS
+         if constexpr (stream_is_tls<DownStream>::value)
+         {
+            start_downstream_handshake();
+            return;
+         }
+         #endif
+
+         connect_upstream();
+      }
+
+      // Start with an already-connected upstream socket taken from the
+      // acceptor's warm pool: no handshake on the first-byte path.
+      // Warm entries are plain TCP; when the upstream side speaks TLS
+      // the pool still saves the connect round trip and the handshake
+      // runs in handle_upstream_connect as usual.
+      void start(socket_type&& upstream)
+      {
+         self_ = this->shared_from_this();
+
+         open_time_ = std::chrono::steady_clock::now();
+
+         if (access_ring_)
+         {
+            access_.open_unix_msec =
+               static_cast<unsigned long long>(
+                  std::chrono::duration_cast<std::chrono::milliseconds>(
+                     std::chrono::system_clock::now().time_since_epoch()).count());
+         }
+
+         if (stats_)
+         {
+            bump(stats_->active_bridges);
+            self_counted_ = true;
+         }
+
+         if (wheel_ && (connect_timeout_seconds > 0))
+         {
+            wheel_->arm(activity_timer_,
+                        timer_wheel::ticks(connect_timeout_seconds));
+         }
+
+         raw_socket(upstream_socket_) = std::move(upstream);
+
+         #ifdef TCPPROXY_TLS
+         if constexpr (stream_is_tls<DownStream>::value)
+         {
+            have_warm_upstream_ = true;
+            start_downstream_handshake();
+            return;
+         }
+         #endif
+
+         handle_upstream_connect(std::error_code());
+      }
+
+      void connect_upstream()
+      {
+         connect_start_    = std::chrono::steady_clock::now();
+         measure_connect_  = true;
+
+         // Attempt connection to remote server (upstream side)
+         raw_socket(upstream_socket_).async_connect(
+              candidates_[candidate_index_],
+              bind_op(a_flow_.read_memory,
+                   [this](const std::error_code& error)
+                   { handle_upstream_connect(error); }));
+      }
+
+      // Failover on a failed connect: the backend's next resolved
+      // address is tried immediately, and once the whole set has
+      // failed the walk restarts after an exponentially growing wheel
+      // delay (1, 2, 4, ... ticks), up to connect_retry_limit rounds.
+      // The connect deadline armed in start() keeps running across
+      // attempts, so the client-visible worst case is unchanged.
+      bool try_next_endpoint()
+      {
+         if (closing_ || (candidate_count_ == 0) || (0 == connect_retry_limit))
+            return false;
+
+         asio::error_code ignore;
+         raw_socket(upstream_socket_).close(ignore);
+
+         if (++candidate_index_ < candidate_count_)
+         {
+            connect_upstream();
+            return true;
+         }
+
+         if ((++retry_round_ > connect_retry_limit) || !wheel_)
+            return false;
+
+         candidate_index_ = 0;
+
+         wheel_->arm(retry_timer_,
+                     std::min(1ul << (retry_round_ - 1),8ul));
+         return true;
+      }
+
+      // Expiry callback from the retry timer; the bridge is held
+      // alive by self_ while parked on the wheel.
+      void retry_connect()
+      {
+         if (!closing_)
+         {
+            connect_upstream();
+            return;
+         }
+
+         maybe_destroy(); // may destroy the bridge, touch nothing after
+      }
+
+      void handle_upstream_connect(const std::error_code& error)
+      {
+         if (!error)
+         {
+            tune_socket(raw_socket(upstream_socket_));
+
+            if (measure_connect_)
+            {
+               const std::chrono::steady_clock::duration elapsed =
+                  std::chrono::steady_clock::now() - connect_start_;
+
+               const double usec =
+                  static_cast<double>(
+                     std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+
+               if (backends_)
+               {
+                  backends_->note_connect_latency(backend_index_,usec);
+               }
+
+               if (flow_ring_)
+               {
+                  report_.connect_usec = static_cast<unsigned int>(usec);
+               }
+
+               if (access_ring_)
+               {
+                  access_.connect_usec = static_cast<unsigned int>(usec);
+               }
+            }
+
+            #ifdef TCPPROXY_TLS
+            if constexpr (stream_is_tls<UpStream>::value)
+            {
+               // Offer the reactor's last session so the backend can
+               // resume instead of running a full key exchange.
+               if (tls_last_session)
+               {
+                  ::SSL_set_session(upstream_socket_.native_handle(),
+                                    tls_last_session);
+               }
+
+               upstream_socket_.async_handshake(
+                    asio::ssl::stream_base::client,
+                    bind_op(a_flow_.read_memory,
+                         [this](const std::error_code& error)
+                         { handle_upstream_handshake(error); }));
+               return;
+            }
+            #endif
+
+            start_forwarding();
+         }
+         else
+         {
+            if (stats_)
+            {
+               bump(stats_->connect_errors);
+            }
+
+            if (try_next_endpoint())
+               return;
+
+            note_close(access_reason::connect_fail);
+            close();
+         }
+      }
+
+      void start_forwarding()
+      {
+         if (wheel_)
+         {
+            if (idle_timeout_seconds > 0)
+            {
+               wheel_->arm(activity_timer_,
+                           timer_wheel::ticks(idle_timeout_seconds));
+            }
+            else
+               wheel_->cancel(activity_timer_);
+         }
+
+         if constexpr (TransferPolicy::prefixed)
+         {
+            if (proxy_protocol)
+            {
+               if (!build_proxy_header())
+               {
+                  note_close(access_reason::error);
+                  close(); // client vanished before its address was read
+                  return;
+               }
+
+               b_flow_.prefix      = pp_header_;
+               b_flow_.prefix_size = pp_length_;
+            }
+         }
+
+         if constexpr (TransferPolicy::reported)
+         {
+            if (flow_ring_ || access_ring_)
+            {
+               try
+               {
+                  const ip::tcp::endpoint peer =
+                     raw_socket(downstream_socket_).remote_endpoint();
+
+                  char text[64];
+
+                  std::snprintf(text,sizeof(text),
+                                "%s:%u",
+                                peer.address().to_string().c_str(),
+                                static_cast<unsigned int>(peer.port()));
+
+                  if (flow_ring_)
+                  {
+                     std::memcpy(report_.peer,text,sizeof(report_.peer));
+                  }
+
+                  if (access_ring_)
+                  {
+                     std::memcpy(access_.peer,text,sizeof(access_.peer));
+                  }
+               }
+               catch(std::exception&)
+               {}
+
+               a_flow_.report_bytes = &report_.a_bytes;
+               b_flow_.report_bytes = &report_.b_bytes;
+            }
+         }
+
+         #ifdef __linux__
+         // Kernel-side splicing only applies when both sides are raw
+         // sockets; a TLS side always runs the buffered engine.
+         if constexpr (
+                        !stream_is_tls<DownStream>::value &&
+                        !stream_is_tls<UpStream>::value
+                      )
+         {
+            if ((engine_mode == forwarding_engine::spliced) && setup_splice())
+            {
+               // The spliced engine cannot gather from user memory, so
+               // the header goes out on its own write before the pumps
+               // start.
+               if constexpr (TransferPolicy::prefixed)
+               {
+                  if (pp_length_ > 0)
+                  {
+                     async_write(upstream_socket_,
+                          asio::buffer(pp_header_,pp_length_),
+                          bind_op(b_flow_.write_memory,
+                               [this](const std::error_code& error, const std::size_t)
+                               {
+                                  if (error)
+                                  {
+                                     note_close(access_reason::error);
+                                     close();
+                                     return;
+                                  }
+
+                                  start_splice(upstream_socket_  , downstream_socket_, upstream_channel_  );
+                                  start_splice(downstream_socket_, upstream_socket_  , downstream_channel_);
+                               }));
+                     return;
+                  }
+               }
+
+               start_splice(upstream_socket_  , downstream_socket_, upstream_channel_  );
+               start_splice(downstream_socket_, upstream_socket_  , downstream_channel_);
+               return;
+            }
+         }
+         #endif
+
+         // Setup pipelined forwarding for both directions
+         a_flow_.source = &upstream_socket_;
+         a_flow_.sink   = &downstream_socket_;
+
+         b_flow_.source = &downstream_socket_;
+         b_flow_.sink   = &upstream_socket_;
+
+         if (stats_)
+         {
+            a_flow_.bytes_counter = &stats_->a_bytes;
+            a_flow_.ops_counter   = &stats_->a_ops;
+            b_flow_.bytes_counter = &stats_->b_bytes;
+            b_flow_.ops_counter   = &stats_->b_ops;
+         }
+
+         if constexpr (TransferPolicy::throttled)
+         {
+            if ((downstream_bps > 0) && throttle_)
+            {
+               // Client-facing egress only; the bucket starts with one
+               // second of burst allowance, matching the accept pacer.
+               a_flow_.throttle    = true;
+               a_flow_.tokens      = static_cast<double>(downstream_bps);
+               a_flow_.last_refill = std::chrono::steady_clock::now();
+            }
+         }
+
+         #ifdef ASIO_HAS_CO_AWAIT
+         if (engine_mode == forwarding_engine::coroutine)
+         {
+            start_coroutines();
+            return;
+         }
+         #endif
+
+         arm_flow_read(a_flow_);
+         arm_flow_read(b_flow_);
+      }
+
+      #ifdef TCPPROXY_TLS
+      void start_downstream_handshake()
+      {
+         downstream_socket_.async_handshake(
+              asio::ssl::stream_base::server,
+              bind_op(b_flow_.read_memory,
+                   [this](const std::error_code& error)
+                   { handle_downstream_handshake(error); }));
+      }
+
+      void handle_downstream_handshake(const std::error_code& error)
+      {
+         if (error)
+         {
+            note_close(access_reason::connect_fail);
+            close();
+            return;
+         }
+
+         if (have_warm_upstream_)
+            handle_upstream_connect(std::error_code());
+         else
+            connect_upstream();
+      }
+
+      void handle_upstream_handshake(const std::error_code& error)
+      {
+         if (error)
+         {
+            if (stats_)
+            {
+               bump(stats_->connect_errors);
+            }
+
+            note_close(access_reason::connect_fail);
+            close();
+            return;
+         }
+
+         if constexpr (stream_is_tls<UpStream>::value)
+         {
+            if (tls_last_session)
+            {
+               ::SSL_SESSION_free(tls_last_session);
+            }
+
+            tls_last_session =
+               ::SSL_get1_session(upstream_socket_.native_handle());
+         }
+
+         start_forwarding();
+      }
+      #endif
+
+      // Invoked by the reactor's throttle clock once per tick while
+      // this bridge is parked waiting for egress tokens. Mirrors the
+      // pending-operation accounting of op_handler.
+      void throttle_tick()
+      {
+         --pending_ops_;
+         a_flow_.throttle_waiting = false;
+
+         if (!closing_)
+         {
+            arm_flow_write(a_flow_);
+         }
+
+         maybe_destroy(); // may destroy the bridge, touch nothing after
+      }
+
+      // Expiry callback from the reactor's timer wheel: the bridge
+      // overran its connect, idle or write deadline. The deadline can
+      // fire with no operation outstanding — e.g. while parked on the
+      // retry timer's backoff — so the zero-op teardown has to happen
+      // here, as in throttle_tick().
+      void handle_timeout()
+      {
+         if (stats_)
+         {
+            bump(stats_->timeouts);
+         }
+
+         note_close(access_reason::timeout);
+         close();
+
+         maybe_destroy(); // may destroy the bridge, touch nothing after
+      }
+
+   private:
+
+      // Uniform access to the transport socket beneath a stream: the
+      // identity for a plain socket, next_layer() for ssl::stream.
+      // Everything socket-level (accept, connect, tuning, shutdown,
+      // close) runs through here.
+      static socket_type& raw_socket(socket_type& s)
+      {
+         return s;
+      }
+
+      #ifdef TCPPROXY_TLS
+      static socket_type& raw_socket(tls_stream_type& s)
+      {
+         return s.next_layer();
+      }
+      #endif
+
+      template <typename Stream>
+      static Stream make_stream(asio::io_context& ios, const bool server_side)
+      {
+         #ifdef TCPPROXY_TLS
+         if constexpr (stream_is_tls<Stream>::value)
+         {
+            return Stream(ios,
+                          server_side ? *tls_server_context
+                                      : *tls_client_context);
+         }
+         else
+         #endif
+         {
+            (void) server_side;
+            return Stream(ios);
+         }
+      }
+
+      // Fills pp_header_ with a PROXY protocol v2 header describing
+      // the accepted client connection. Returns false if the
+      // downstream endpoints can no longer be read.
+      bool build_proxy_header()
+      {
+         static const unsigned char signature[12] =
+         {
+            0x0D,0x0A,0x0D,0x0A,0x00,0x0D,0x0A,0x51,0x55,0x49,0x54,0x0A
+         };
+
+         ip::tcp::endpoint src;
+         ip::tcp::endpoint dst;
+
+         try
+         {
+            src = downstream_socket().remote_endpoint();
+            dst = downstream_socket().local_endpoint();
+         }
+         catch(std::exception&)
+         {
+            return false;
+         }
+
+         std::memcpy(pp_header_,signature,sizeof(signature));
+
+         pp_header_[12] = 0x21; // version 2, command PROXY
+
+         unsigned char* address = pp_header_ + 16;
+
+         std::size_t address_length = 0;
+
+         if (src.address().is_v4())
+         {
+            pp_header_[13] = 0x11; // TCP over IPv4
+
+            const ip::address_v4::bytes_type src_bytes = src.address().to_v4().to_bytes();
+            const ip::address_v4::bytes_type dst_bytes = dst.address().to_v4().to_bytes();
+
+            std::memcpy(address    ,src_bytes.data(),4);
+            std::memcpy(address + 4,dst_bytes.data(),4);
+
+            address        += 8;
+            address_length  = 12;
+         }
+         else
+         {
+            pp_header_[13] = 0x21; // TCP over IPv6
+
+            const ip::address_v6::bytes_type src_bytes = src.address().to_v6().to_bytes();
+            const ip::address_v6::bytes_type dst_bytes = dst.address().to_v6().to_bytes();
+
+            std::memcpy(address     ,src_bytes.data(),16);
+            std::memcpy(address + 16,dst_bytes.data(),16);
+
+            address        += 32;
+            address_length  = 36;
+         }
+
+         pp_header_[14] = static_cast<unsigned char>(address_length >> 8);
+         pp_header_[15] = static_cast<unsigned char>(address_length & 0xFF);
+
+         address[0] = static_cast<unsigned char>(src.port() >> 8);
+         address[1] = static_cast<unsigned char>(src.port() & 0xFF);
+         address[2] = static_cast<unsigned char>(dst.port() >> 8);
+         address[3] = static_cast<unsigned char>(dst.port() & 0xFF);
+
+         pp_length_ = 16 + address_length;
+
+         return true;
+      }
+
+      // Lightweight completion handler: raw bridge pointer, recycling
+      // allocation out of the given handler_memory slot, and pending
+      // operation accounting. Replaces the old std::bind plumbing that
+      // copied a shared_ptr and heap-allocated per I/O operation.
+      template <typename Handler>
+      class op_handler
+      {
+      public:
+
+         typedef handler_allocator<op_handler> allocator_type;
+
+         op_handler(bridge& self, handler_memory& memory, Handler handler)
+         : self_   (&self),
+           memory_ (&memory),
+           handler_(std::move(handler))
+         {}
+
+         allocator_type get_allocator() const
+         {
+            return allocator_type(*memory_);
+         }
+
+         template <typename... Args>
+         void operator()(Args&&... args)
+         {
+            if (local_profile)
+            {
+               bump(local_profile->dispatches);
+            }
+
+            bridge& self = *self_;
+            --self.pending_ops_;
+            handler_(std::forward<Args>(args)...);
+            self.maybe_destroy(); // may destroy the bridge, touch nothing after
+         }
+
+      private:
+
+         bridge* self_;
+         handler_memory* memory_;
+         Handler handler_;
+      };
+
+      template <typename Handler>
+      op_handler<Handler> bind_op(handler_memory& memory, Handler handler)
+      {
+         ++pending_ops_;
+         return op_handler<Handler>(*this,memory,std::move(handler));
+      }
+
+      // Drops the self reference once the bridge has been closed and
+      // the last outstanding handler has drained.
+      void maybe_destroy()
+      {
+         if (closing_ && (pending_ops_ == 0))
+         {
+            self_.reset();
+         }
+      }
+
+      /*
+         Sections A and B: pipelined full-duplex forwarding.
+         Section A is the flow remote server --> proxy --> client,
+         section B the flow client --> proxy --> remote server. Both
+         run the same pump over a small ring of leased chunks: reads
+         keep filling the ring while earlier writes drain, and reads
+         pause once queued bytes reach the high-water mark, converting
+         a slow sink into TCP backpressure on the source. Each flush
+         gathers every queued chunk into one vectored write, so a
+         burst of small frames costs one writev instead of one write
+         per frame.
+      */
+
+      enum { flow_ring_size = 4 };
+
+      template <typename Source, typename Sink>
+      struct flow
+      {
+         enum { ring_size = flow_ring_size };
+
+         Source* source = nullptr;
+         Sink*   sink   = nullptr;
+
+         leased_buffer chunk[ring_size];
+         std::size_t filled[ring_size] = { 0 };
+
+         std::size_t head         = 0; // next chunk to write
+         std::size_t count        = 0; // chunks read but not yet written
+         std::size_t read_slot    = 0;
+         std::size_t queued_bytes = 0;
+
+         bool read_armed  = false;
+         bool write_armed = false;
+
+         std::size_t write_count = 0; // chunks in the in-flight gathered write
+
+         bool source_eof  = false;
+         bool finished    = false; // EOF seen and fully drained
+
+         // Egress token bucket (--maxbps); whole chunks are written
+         // and the balance may dip below zero, which simply lengthens
+         // the wait before the next write.
+         bool throttle         = false;
+         bool throttle_waiting = false;
+         double tokens         = 0;
+         std::chrono::steady_clock::time_point last_refill;
+
+         stat_counter* bytes_counter = nullptr;
+         stat_counter* ops_counter   = nullptr;
+
+         // Per-bridge reporting (--flowlog): byte total for this
+         // direction and the read timestamp of each queued chunk, so
+         // the write completion can attribute forwarding latency.
+         unsigned long long* report_bytes = nullptr;
+         std::chrono::steady_clock::time_point read_time[ring_size];
+
+         // Bytes prepended to this direction's first write (PROXY
+         // protocol header), gathered with the payload chunk.
+         const unsigned char* prefix = nullptr;
+         std::size_t prefix_size     = 0;
+
+         handler_memory read_memory;
+         handler_memory write_memory;
+      };
+
+      // Fixed-capacity buffer sequence for gathered writes: a pending
+      // prefix plus up to a full ring of chunks, built without
+      // touching the heap. Models asio's ConstBufferSequence.
+      struct gather_buffers
+      {
+         std::array<asio::const_buffer,1 + flow_ring_size> list;
+         std::size_t count = 0;
+
+         void add(const void* data, const std::size_t size)
+         {
+            list[count++] = asio::buffer(data,size);
+         }
+
+         const asio::const_buffer* begin() const { return list.data();         }
+         const asio::const_buffer* end  () const { return list.data() + count; }
+      };
+
+      template <typename FlowT>
+      void arm_flow_read(FlowT& f)
+      {
+         if (f.read_armed || f.source_eof || closing_)
+            return;
+
+         if (f.count == FlowT::ring_size) // ring full
+            return;
+
+         if (f.queued_bytes >= pipeline_high_water) // flow control
+            return;
+
+         // Memory budget (--maxmem): while the proxy is over budget,
+         // flows already holding a backlog — the ones sitting on
+         // multiple leased chunks — stop refilling the ring. The
+         // write completion that drains the backlog re-arms the read
+         // regardless, so a bridge degrades to stop-and-wait under
+         // pressure rather than stalling.
+         if ((f.queued_bytes > 0) && over_memory_budget())
+            return;
+
+         f.read_slot = (f.head + f.count) % FlowT::ring_size;
+
+         leased_buffer& chunk = f.chunk[f.read_slot];
+
+         if (0 == chunk.data())
+         {
+            chunk.lease(pool_);
+         }
+
+         f.read_armed = true;
+
+         f.source->async_read_some(
+              asio::buffer(chunk.data(),chunk.size()),
+              bind_op(f.read_memory,
+                   [this, &f](const std::error_code& error, const std::size_t bytes_transferred)
+                   { handle_flow_read(f,error,bytes_transferred); }));
+      }
+
+      template <typename FlowT>
+      void handle_flow_read(FlowT& f, const std::error_code& error,
+                            const std::size_t bytes_transferred)
+      {
+         f.read_armed = false;
+
+         if (error)
+         {
+            if (error == asio::error::eof)
+            {
+               // Half close: stop reading this direction, let queued
+               // chunks drain, then propagate the shutdown. The other
+               // direction keeps forwarding until its own EOF.
+               f.source_eof = true;
+               maybe_finish_flow(f);
+            }
+            else
+            {
+               note_close(access_reason::error);
+               close();
+            }
+
+            return;
+         }
+
+         f.filled[f.read_slot] = bytes_transferred;
+         f.queued_bytes += bytes_transferred;
+         ++f.count;
+
+         if (f.bytes_counter)
+         {
+            bump(*f.bytes_counter,bytes_transferred);
+            bump(*f.ops_counter);
+         }
+
+         if constexpr (TransferPolicy::reported)
+         {
+            if (f.report_bytes)
+            {
+               *f.report_bytes += bytes_transferred;
+               f.read_time[f.read_slot] = std::chrono::steady_clock::now();
+            }
+         }
+
+         // O(1) idle re-arm per read completion.
+         if (wheel_ && (idle_timeout_seconds > 0))
+         {
+            wheel_->arm(activity_timer_,
+                        timer_wheel::ticks(idle_timeout_seconds));
+         }
+
+         arm_flow_write(f);
+         arm_flow_read (f);
+      }
+
+      template <typename FlowT>
+      void arm_flow_write(FlowT& f)
+      {
+         if (f.write_armed || f.throttle_waiting || (f.count == 0))
+            return;
+
+         if constexpr (TransferPolicy::throttled)
+         {
+            if (f.throttle)
+            {
+               refill_flow_tokens(f);
+
+               if (f.tokens <= 0)
+               {
+                  // Park on the reactor's shared clock; the wait counts
+                  // as a pending operation so the bridge stays alive.
+                  f.throttle_waiting = true;
+                  ++pending_ops_;
+                  throttle_->wait(this,
+                       [](void* self)
+                       { static_cast<bridge*>(self)->throttle_tick(); });
+                  return;
+               }
+
+               f.tokens -= static_cast<double>(f.queued_bytes);
+            }
+         }
+
+         f.write_armed = true;
+
+         // The write deadline tracks the oldest outstanding write; it
+         // is armed on the transition to having one in flight and
+         // refreshed by each completion.
+         if (wheel_ && (write_timeout_seconds > 0) && !write_timer_.linked())
+         {
+            wheel_->arm(write_timer_,
+                        timer_wheel::ticks(write_timeout_seconds));
+         }
+
+         // Flush everything queued — the pending header, if any, and
+         // every filled chunk — as one gathered write. Reads that
+         // complete while this write is in flight accumulate in the
+         // ring and are coalesced into the next flush.
+         gather_buffers buffers;
+
+         if constexpr (TransferPolicy::prefixed)
+         {
+            if (f.prefix_size > 0)
+            {
+               buffers.add(f.prefix,f.prefix_size);
+            }
+         }
+
+         f.write_count = f.count;
+
+         for (std::size_t i = 0; i < f.write_count; ++i)
+         {
+            const std::size_t slot = (f.head + i) % FlowT::ring_size;
+
+            buffers.add(f.chunk[slot].data(),f.filled[slot]);
+         }
+
+         async_write(*f.sink,
+              buffers,
+              bind_op(f.write_memory,
+                   [this, &f](const std::error_code& error, const std::size_t)
+                   { handle_flow_write(f,error); }));
+      }
+
+      template <typename FlowT>
+      void refill_flow_tokens(FlowT& f)
+      {
+         const std::chrono::steady_clock::time_point now =
+            std::chrono::steady_clock::now();
+
+         const double elapsed =
+            std::chrono::duration_cast<std::chrono::duration<double>>(
+               now - f.last_refill).count();
+
+         f.last_refill = now;
+
+         f.tokens = std::min(static_cast<double>(downstream_bps),
+                             f.tokens + (elapsed * downstream_bps));
+      }
+
+      template <typename FlowT>
+      void handle_flow_write(FlowT& f, const std::error_code& error)
+      {
+         f.write_armed = false;
+
+         if (error)
+         {
+            note_close(access_reason::error);
+            close();
+            return;
+         }
+
+         if constexpr (TransferPolicy::prefixed)
+         {
+            f.prefix_size = 0;
+         }
+
+         if (wheel_ && (write_timeout_seconds > 0))
+         {
+            if (a_flow_.write_armed || b_flow_.write_armed)
+            {
+               wheel_->arm(write_timer_,
+                           timer_wheel::ticks(write_timeout_seconds));
+            }
+            else
+               wheel_->cancel(write_timer_);
+         }
+
+         // Every gathered chunk has fully drained into the sink, so
+         // each is free to change size class and to be reused by a
+         // subsequent read.
+         std::chrono::steady_clock::time_point now;
+
+         if constexpr (TransferPolicy::reported)
+         {
+            if (f.report_bytes)
+            {
+               now = std::chrono::steady_clock::now();
+            }
+         }
+
+         for (std::size_t i = 0; i < f.write_count; ++i)
+         {
+            if constexpr (TransferPolicy::reported)
+            {
+               if (f.report_bytes)
+               {
+                  report_.sample(
+                     static_cast<unsigned long long>(
+                        std::chrono::duration_cast<std::chrono::microseconds>(
+                           now - f.read_time[f.head]).count()));
+               }
+            }
+
+            f.chunk[f.head].note_read(f.filled[f.head]);
+
+            f.queued_bytes -= f.filled[f.head];
+            f.head = (f.head + 1) % FlowT::ring_size;
+            --f.count;
+         }
+
+         f.write_count = 0;
+
+         arm_flow_write(f);
+         arm_flow_read (f);
+
+         maybe_finish_flow(f);
+      }
+
+      // Once a direction has seen EOF and drained everything queued,
+      // pass the FIN on to the sink's write side. The bridge is torn
+      // down only when both directions have finished.
+      template <typename FlowT>
+      void maybe_finish_flow(FlowT& f)
+      {
+         if (f.finished || !f.source_eof || (f.count != 0) || f.write_armed)
+            return;
+
+         if constexpr (TransferPolicy::prefixed)
+         {
+            if (f.prefix_size > 0)
+            {
+               // The client closed without sending a byte; the header
+               // still has to reach the backend before the FIN does.
+               f.write_armed = true;
+
+               async_write(*f.sink,
+                    asio::buffer(f.prefix,f.prefix_size),
+                    bind_op(f.write_memory,
+                         [this, &f](const std::error_code& error, const std::size_t)
+                         {
+                            f.write_armed = false;
+                            f.prefix_size = 0;
+
+                            if (error)
+                            {
+                               note_close(access_reason::error);
+                               close();
+                               return;
+                            }
+
+                            maybe_finish_flow(f);
+                         }));
+               return;
+            }
+         }
+
+         f.finished = true;
+
+         // TLS sides propagate the FIN on the transport socket rather
+         // than a close_notify exchange; peers treat the truncation
+         // exactly as they would from the stunnel chain this replaces.
+         try
+         {
+            raw_socket(*f.sink).shutdown(asio::socket_base::shutdown_send);
+         }
+         catch(std::exception&)
+         {}
+
+         if (a_flow_.finished && b_flow_.finished)
+         {
+            close();
+         }
+      }
+      // *** End Of Sections A/B ***
+
+
+      #ifdef __linux__
+      /*
+         Section C: Zero-copy forwarding (Linux)
+         Each direction owns a pipe pair. Payload is spliced from the
+         source socket into the pipe and from the pipe into the sink
+         socket, so it never crosses into userspace. Socket readiness
+         is still driven by the reactor via async_wait.
+      */
+
+      struct splice_channel
+      {
+         int pipe_fd[2] = { -1, -1 };
+         std::size_t pending = 0; // bytes parked in the pipe
+         bool source_eof = false;
+      };
+
+      bool setup_splice()
+      {
+         if (::pipe2(upstream_channel_.pipe_fd,O_NONBLOCK | O_CLOEXEC) < 0)
+         {
+            return false;
+         }
+
+         if (::pipe2(downstream_channel_.pipe_fd,O_NONBLOCK | O_CLOEXEC) < 0)
+         {
+            close_splice(upstream_channel_);
+            return false;
+         }
+
+         // A larger pipe means fewer splice calls per MB; best effort.
+         ::fcntl(upstream_channel_.pipe_fd[1]  ,F_SETPIPE_SZ,splice_pipe_size);
+         ::fcntl(downstream_channel_.pipe_fd[1],F_SETPIPE_SZ,splice_pipe_size);
+
+         try
+         {
+            downstream_socket_.non_blocking(true);
+            upstream_socket_.non_blocking(true);
+         }
+         catch(std::exception&)
+         {
+            return false;
+         }
+
+         return true;
+      }
+
+      handler_memory& splice_memory(splice_channel& channel)
+      {
+         return (&channel == &upstream_channel_) ? a_flow_.read_memory : b_flow_.read_memory;
+      }
+
+      void start_splice(socket_type& source, socket_type& sink, splice_channel& channel)
+      {
+         source.async_wait(socket_type::wait_read,
+              bind_op(splice_memory(channel),
+                   [this, &source, &sink, &channel](const std::error_code& error)
+                   { handle_splice_readable(source,sink,channel,error); }));
+      }
+
+      void handle_splice_readable(socket_type& source, socket_type& sink,
+                                  splice_channel& channel,
+                                  const std::error_code& error)
+      {
+         if (error)
+         {
+            note_close(access_reason::error);
+            close();
+            return;
+         }
+
+         if (wheel_ && (idle_timeout_seconds > 0))
+         {
+            wheel_->arm(activity_timer_,
+                        timer_wheel::ticks(idle_timeout_seconds));
+         }
+
+         // Bounded pump so one fast flow cannot starve the reactor.
+         for (int round = 0; round < splice_max_rounds; ++round)
+         {
+            if (channel.pending == 0)
+            {
+               const ssize_t n = ::splice(source.native_handle(), nullptr,
+                                          channel.pipe_fd[1], nullptr,
+                                          splice_pipe_size,
+                                          SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+               if (n == 0) // EOF, nothing left parked in the pipe
+               {
+                  channel.source_eof = true;
+
+                  try
+                  {
+                     sink.shutdown(asio::socket_base::shutdown_send);
+                  }
+                  catch(std::exception&)
+                  {}
+
+                  if (upstream_channel_.source_eof && downstream_channel_.source_eof)
+                  {
+                     close();
+                  }
+
+                  return;
+               }
+               else if (n < 0)
+               {
+                  if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+                  {
+                     start_splice(source,sink,channel);
+                  }
+                  else
+                  {
+                     note_close(access_reason::error);
+                     close();
+                  }
+
+                  return;
+               }
+
+               channel.pending = static_cast<std::size_t>(n);
+
+               const bool is_a = (&channel == &upstream_channel_);
+
+               if (stats_)
+               {
+                  bump(is_a ? stats_->a_bytes : stats_->b_bytes,channel.pending);
+                  bump(is_a ? stats_->a_ops   : stats_->b_ops);
+               }
+
+               // Spliced payload never reaches userspace, so only the
+               // byte totals feed the flow and access reports;
+               // forwarding latency is not observable here.
+               if constexpr (TransferPolicy::reported)
+               {
+                  if (flow_ring_ || access_ring_)
+                  {
+                     (is_a ? report_.a_bytes : report_.b_bytes) += channel.pending;
+                  }
+               }
+            }
+
+            if (!drain_splice(source,sink,channel))
+               return;
+         }
+
+         start_splice(source,sink,channel);
+      }
+
+      // Move parked bytes pipe -> sink. Returns false when the caller
+      // must stop pumping (handler re-armed or bridge closed).
+      bool drain_splice(socket_type& source, socket_type& sink, splice_channel& channel)
+      {
+         while (channel.pending > 0)
+         {
+            const ssize_t n = ::splice(channel.pipe_fd[0], nullptr,
+                                       sink.native_handle(), nullptr,
+                                       channel.pending,
+                                       SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+            if (n < 0)
+            {
+               if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+               {
+                  sink.async_wait(socket_type::wait_write,
+                       bind_op(splice_memory(channel),
+                            [this, &source, &sink, &channel](const std::error_code& error)
+                            { handle_splice_writable(source,sink,channel,error); }));
+               }
+               else
+               {
+                  note_close(access_reason::error);
+                  close();
+               }
+
+               return false;
+            }
+
+            channel.pending -= static_cast<std::size_t>(n);
+         }
+
+         return true;
+      }
+
+      void handle_splice_writable(socket_type& source, socket_type& sink,
+                                  splice_channel& channel,
+                                  const std::error_code& error)
+      {
+         if (error)
+         {
+            note_close(access_reason::error);
+            close();
+            return;
+         }
+
+         if (drain_splice(source,sink,channel))
+         {
+            start_splice(source,sink,channel);
+         }
+      }
+
+      static void close_splice(splice_channel& channel)
+      {
+         for (int i = 0; i < 2; ++i)
+         {
+            if (channel.pipe_fd[i] >= 0)
+            {
+               ::close(channel.pipe_fd[i]);
+               channel.pipe_fd[i] = -1;
+            }
+         }
+      }
+
+      enum
+      {
+         splice_pipe_size  = 1048576, //1MB
+         splice_max_rounds = 16
+      };
+
+      splice_channel upstream_channel_;
+      splice_channel downstream_channel_;
+      // *** End Of Section C ***
+      #endif
+
+
+      #ifdef ASIO_HAS_CO_AWAIT
+      /*
+         Section D: Coroutine forwarding (--coro)
+         Each direction is a single coroutine running a stop-and-wait
+         read/write loop over one leased chunk. Where the buffered
+         engine pays a handler dispatch per completion, the coroutine
+         simply resumes at the co_await point, so a forwarded chunk
+         costs two suspensions and no intermediate state. Works over
+         TLS sides as well, unlike the spliced engine.
+      */
+
+      template <typename FlowT>
+      asio::awaitable<void> pump_flow(FlowT& f)
+      {
+         asio::error_code error;
+
+         leased_buffer& chunk = f.chunk[0];
+
+         if (0 == chunk.data())
+         {
+            chunk.lease(pool_);
+         }
+
+         // The PROXY protocol header precedes the first payload byte
+         // of the client --> server direction.
+         if constexpr (TransferPolicy::prefixed)
+         {
+            if (f.prefix_size > 0)
+            {
+               co_await async_write(*f.sink,
+                    asio::buffer(f.prefix,f.prefix_size),
+                    asio::redirect_error(asio::use_awaitable,error));
+
+               f.prefix_size = 0;
+
+               if (error)
+               {
+                  note_close(access_reason::error);
+                  close();
+                  finish_pump();
+                  co_return;
+               }
+            }
+         }
+
+         for ( ; ; )
+         {
+            const std::size_t bytes_transferred =
+               co_await f.source->async_read_some(
+                    asio::buffer(chunk.data(),chunk.size()),
+                    asio::redirect_error(asio::use_awaitable,error));
+
+            if (error)
+            {
+               if (error == asio::error::eof)
+               {
+                  // Half close, same contract as the buffered engine:
+                  // pass the FIN on, let the other direction run to
+                  // its own EOF.
+                  try
+                  {
+                     raw_socket(*f.sink).shutdown(asio::socket_base::shutdown_send);
+                  }
+                  catch(std::exception&)
+                  {}
+               }
+               else
+               {
+                  note_close(access_reason::error);
+                  close();
+               }
+
+               break;
+            }
+
+            if (f.bytes_counter)
+            {
+               bump(*f.bytes_counter,bytes_transferred);
+               bump(*f.ops_counter);
+            }
+
+            if constexpr (TransferPolicy::reported)
+            {
+               if (f.report_bytes)
+               {
+                  *f.report_bytes += bytes_transferred;
+                  f.read_time[0] = std::chrono::steady_clock::now();
+               }
+            }
+
+            // O(1) idle re-arm per read, as in the buffered engine.
+            if (wheel_ && (idle_timeout_seconds > 0))
+            {
+               wheel_->arm(activity_timer_,
+                           timer_wheel::ticks(idle_timeout_seconds));
+            }
+
+            if constexpr (TransferPolicy::throttled)
+            {
+               if (f.throttle)
+               {
+                  refill_flow_tokens(f);
+
+                  // Same bucket as the buffered engine, but parked on a
+                  // per-frame timer: the shared clock wakes its waiters
+                  // through a plain thunk, which cannot resume a
+                  // coroutine. The timer only exists while the bucket
+                  // is dry, so an unthrottled pump pays nothing.
+                  if (f.tokens <= 0)
+                  {
+                     asio::steady_timer pace(
+                        raw_socket(*f.sink).get_executor());
+
+                     while ((f.tokens <= 0) && !closing_)
+                     {
+                        pace.expires_after(std::chrono::milliseconds(
+                           static_cast<long>(throttle_clock::tick_msec)));
+
+                        co_await pace.async_wait(
+                           asio::redirect_error(asio::use_awaitable,error));
+
+                        refill_flow_tokens(f);
+                     }
+
+                     if (closing_)
+                     {
+                        break;
+                     }
+                  }
+
+                  f.tokens -= static_cast<double>(bytes_transferred);
+               }
+            }
+
+            // The write deadline mirrors the buffered path: armed on
+            // the transition to having a write in flight, refreshed
+            // while the other pump still has one, cancelled otherwise.
+            if (wheel_ && (write_timeout_seconds > 0) && !write_timer_.linked())
+            {
+               wheel_->arm(write_timer_,
+                           timer_wheel::ticks(write_timeout_seconds));
+            }
+
+            f.write_armed = true;
+
+            co_await async_write(*f.sink,
+                 asio::buffer(chunk.data(),bytes_transferred),
+                 asio::redirect_error(asio::use_awaitable,error));
+
+            f.write_armed = false;
+
+            if (wheel_ && (write_timeout_seconds > 0))
+            {
+               if (a_flow_.write_armed || b_flow_.write_armed)
+               {
+                  wheel_->arm(write_timer_,
+                              timer_wheel::ticks(write_timeout_seconds));
+               }
+               else
+                  wheel_->cancel(write_timer_);
+            }
+
+            if (error)
+            {
+               note_close(access_reason::error);
+               close();
+               break;
+            }
+
+            if constexpr (TransferPolicy::reported)
+            {
+               if (f.report_bytes)
+               {
+                  report_.sample(
+                     static_cast<unsigned long long>(
+                        std::chrono::duration_cast<std::chrono::microseconds>(
+                           std::chrono::steady_clock::now() - f.read_time[0]).count()));
+               }
+            }
+
+            chunk.note_read(bytes_transferred);
+         }
+
+         finish_pump();
+      }
+
+      void start_coroutines()
+      {
+         ptr_type self = this->shared_from_this();
+
+         // The completion handlers hold the bridge alive for as long
+         // as either coroutine frame exists. Coroutine operations do
+         // not pass through pending_ops_/maybe_destroy(), so keeping
+         // self_ as well would leak the bridge; the reference counting
+         // contract moves to the frames instead.
+         asio::co_spawn(
+            raw_socket(downstream_socket_).get_executor(),
+            pump_flow(a_flow_),
+            [self](std::exception_ptr) {});
+
+         asio::co_spawn(
+            raw_socket(downstream_socket_).get_executor(),
+            pump_flow(b_flow_),
+            [self](std::exception_ptr) {});
+
+         self_.reset();
+      }
+
+      void finish_pump()
+      {
+         if (++finished_pumps_ == 2)
+         {
+            close();
+         }
+      }
+
+      unsigned int finished_pumps_ = 0;
+      // *** End Of Section D ***
+      #endif
+
+
+      // Records why the bridge is going down. Only the first cause
+      // counts: once close() has run, the errors its aborted
+      // operations report are fallout, not the reason.
+      void note_close(const access_reason reason)
+      {
+         if (closing_)
+            return;
+
+         if (access_.reason == static_cast<unsigned char>(access_reason::eof))
+         {
+            access_.reason = static_cast<unsigned char>(reason);
+         }
+      }
+
+      void close()
+      {
+         std::scoped_lock lock(mutex_);
+
+         closing_ = true;
+
+         if (raw_socket(downstream_socket_).is_open())
+         {
+            raw_socket(downstream_socket_).close();
+         }
+
+         if (raw_socket(upstream_socket_).is_open())
+         {
+            raw_socket(upstream_socket_).close();
+         }
+      }
+
+      DownStream downstream_socket_;
+      UpStream upstream_socket_;
+
+      buffer_pool& pool_;
+
+      flow<UpStream,DownStream> a_flow_; // remote server --> client
+      flow<DownStream,UpStream> b_flow_; // client --> remote server
+
+      ptr_type self_;
+      std::size_t pending_ops_ = 0;
+      bool closing_            = false;
+
+      reactor_counters* stats_   = nullptr;
+      throttle_clock* throttle_  = nullptr;
+      timer_wheel* wheel_        = nullptr;
+      flow_report_ring* flow_ring_ = nullptr;
+      flow_report report_;
+      access_record_ring* access_ring_ = nullptr;
+      access_record access_;
+      std::chrono::steady_clock::time_point open_time_;
+      timer_wheel::entry activity_timer_;
+      timer_wheel::entry write_timer_;
+      timer_wheel::entry retry_timer_;
+      bool self_counted_         = false;
+      acceptor* owner_           = nullptr;
+      backend_set* backends_     = nullptr;
+      std::size_t backend_index_ = 0;
+      std::chrono::steady_clock::time_point connect_start_;
+      bool measure_connect_      = false;
+
+      // Resolved addresses of the selected backend, walked in order
+      // by the connect failover.
+      enum { max_candidates = 4 };
+
+      ip::tcp::endpoint candidates_[max_candidates];
+      std::size_t candidate_count_ = 0;
+      std::size_t candidate_index_ = 0;
+      unsigned int retry_round_    = 0;
+
+      // Largest v2 header: 16 byte base plus two IPv6 address/port
+      // pairs.
+      unsigned char pp_header_[52];
+      std::size_t pp_length_     = 0;
+
+      #ifdef TCPPROXY_TLS
+      bool have_warm_upstream_   = false;
+      #endif
+
+      std::mutex mutex_;
+
+   public:
+
+      class acceptor
+      {
+      public:
+
+         acceptor(asio::io_context& io_service,
+                  const std::string& local_host, unsigned short local_port,
+                  const std::string& upstream_host, unsigned short upstream_port)
+         : io_service_(io_service),
+           localhost_address(asio::ip::make_address_v4(local_host)),
+           acceptor_(io_service_),
+           endpoint_cache_(io_service_),
+           backends_(new backend_set()),
+           upstream_port_(upstream_port),
+           upstream_seen_(upstream_generation.load(std::memory_order_acquire))
+         {
+            parse_backend_list(upstream_host,upstream_port,*backends_);
+
+            if (backends_->size() == 0)
+            {
+               throw std::runtime_error("acceptor: no upstream backends given");
+            }
+
+            ip::tcp::endpoint endpoint(localhost_address,local_port);
+
+            acceptor_.open(endpoint.protocol());
+            acceptor_.set_option(ip::tcp::acceptor::reuse_address(true));
+
+            // Allow one listen socket per reactor so the kernel shards
+            // incoming connections across reactors without any hand-off.
+            #ifdef SO_REUSEPORT
+            typedef asio::detail::socket_option::boolean<SOL_SOCKET,SO_REUSEPORT> reuse_port;
+            acceptor_.set_option(reuse_port(true));
+            #endif
+
+            #ifdef TCP_FASTOPEN
+            if (tuning.fastopen > 0)
+            {
+               typedef asio::detail::socket_option::integer<IPPROTO_TCP,TCP_FASTOPEN> fast_open;
+               acceptor_.set_option(fast_open(tuning.fastopen));
+            }
+            #endif
+
+            acceptor_.bind(endpoint);
+            acceptor_.listen(asio::socket_base::max_listen_connections);
+
+            refill_warm_pool();
+         }
+
+         // Keeps accept_depth accepts outstanding, each with its own
+         // pre-constructed bridge; a burst of connections completes
+         // several of them in one loop pass.
+         bool accept_connections()
+         {
+            while (outstanding_accepts_ < accept_depth)
+            {
+               // Concurrency cap: stop accepting entirely and let the
+               // listen backlog queue; bridge_closed() resumes us.
+               if (
+                    (max_bridges_per_reactor > 0) &&
+                    ((active_bridges_ + outstanding_accepts_) >= max_bridges_per_reactor)
+                  )
+               {
+                  accept_paused_ = true;
+                  return true;
+               }
+
+               // Accept rate cap: take a token per armed accept, or
+               // sleep out the deficit on the pacing timer.
+               if (accept_rate_per_reactor > 0)
+               {
+                  refill_accept_tokens();
+
+                  if (accept_tokens_ < 1.0)
+                  {
+                     const long wait_usec =
+                        static_cast<long>(((1.0 - accept_tokens_) / accept_rate_per_reactor) * 1e6);
+
+                     pace_timer_.expires_after(std::chrono::microseconds(wait_usec));
+
+                     pace_timer_.async_wait(
+                          [this](const std::error_code& error)
+                          {
+                             if (!error)
+                             {
+                                accept_connections();
+                             }
+                          });
+
+                     return true;
+                  }
+
+                  accept_tokens_ -= 1.0;
+               }
+
+               try
+               {
+                  const ptr_type session = std::allocate_shared<bridge>(
+                                                recycling_allocator<bridge>(bridge_pool_),
+                                                io_service_,pool_);
+
+                  acceptor_.async_accept(session->downstream_socket(),
+                       [this, session](const std::error_code& error)
+                       { handle_accept(session,error); });
+               }
+               catch(std::exception& e)
+               {
+                  std::cerr << "acceptor exception: " << e.what() << std::endl;
+                  return false;
+               }
+
+               ++outstanding_accepts_;
+            }
+
+            return true;
+         }
+
+         // Called from ~bridge on this reactor's thread.
+         void bridge_closed()
+         {
+            --active_bridges_;
+
+            if (
+                 accept_paused_ &&
+                 (active_bridges_ < max_bridges_per_reactor)
+               )
+            {
+               accept_paused_ = false;
+               accept_connections();
+            }
+         }
+
+      private:
+
+         void handle_accept(const ptr_type& session, const std::error_code& error)
+         {
+            --outstanding_accepts_;
+
+            if (!error)
+            {
+               maybe_reload_backends();
+
+               if (local_stats)
+               {
+                  bump(local_stats->accepts);
+               }
+
+               tune_socket(session->downstream_socket());
+
+               ++active_bridges_;
+               session->set_owner(*this);
+
+               std::unique_ptr<warm_entry> warm_upstream = take_warm_upstream();
+
+               if (warm_upstream)
+               {
+                  session->set_backend(*backends_,warm_upstream->backend_index);
+                  session->start(std::move(warm_upstream->socket));
+               }
+               else
+               {
+                  const std::size_t backend_index     = backends_->select();
+                  const backend_set::backend& backend = backends_->at(backend_index);
+
+                  session->set_backend(*backends_,backend_index);
+
+                  endpoint_cache_.resolve(backend.host,backend.port,
+                       [session](const std::error_code& error,
+                                 const std::vector<ip::tcp::endpoint>& endpoints)
+                       {
+                          if (!error)
+                             session->start(endpoints);
+                          else
+                          {
+                             if (local_stats)
+                             {
+                                bump(local_stats->connect_errors);
+                             }
+
+                             std::cerr << "Error: resolve: " << error.message() << std::endl;
+                          }
+                       });
+               }
+
+               refill_warm_pool();
+
+               if (!accept_connections())
+               {
+                  std::cerr << "Failure during call to accept." << std::endl;
+               }
+            }
+            else
+            {
+               std::cerr << "Error: " << error.message() << std::endl;
+            }
+         }
+
+         /*
+            Warm upstream pool: connections to the remote server are
+            established ahead of demand and handed to new bridges, so
+            an accepted client does not wait out the upstream
+            handshake. Idle entries are watched for EOF so a backend
+            that drops its end is quietly replaced.
+         */
+
+         struct warm_entry
+         {
+            explicit warm_entry(asio::io_context& ios)
+            : socket(ios)
+            {}
+
+            socket_type socket;
+            std::size_t backend_index = 0;
+            bool connected = false;
+         };
+
+         void refill_warm_pool()
+         {
+            while (warm_pool_.size() < warm_pool_target)
+            {
+               std::unique_ptr<warm_entry> entry(new warm_entry(io_service_));
+               warm_entry* raw = entry.get();
+
+               raw->backend_index = backends_->select();
+
+               const backend_set::backend& backend = backends_->at(raw->backend_index);
+
+               warm_pool_.push_back(std::move(entry));
+
+               endpoint_cache_.resolve(backend.host,backend.port,
+                    [this, raw](const std::error_code& error,
+                                const std::vector<ip::tcp::endpoint>& endpoints)
+                    {
+                       const std::size_t index = find_warm_entry(raw);
+
+                       if (index == warm_pool_.size())
+                          return;
+
+                       if (error || endpoints.empty())
+                       {
+                          warm_pool_.erase(warm_pool_.begin() + index);
+                          return;
+                       }
+
+                       raw->socket.async_connect(endpoints.front(),
+                            [this, raw](const std::error_code& error)
+                            { handle_warm_connect(raw,error); });
+                    });
+            }
+         }
+
+         void handle_warm_connect(warm_entry* entry, const std::error_code& error)
+         {
+            const std::size_t index = find_warm_entry(entry);
+
+            if (index == warm_pool_.size()) // already discarded
+               return;
+
+            if (error)
+            {
+               // Backend unreachable: drop the entry and let the next
+               // accept trigger another refill attempt rather than
+               // reconnecting in a hot loop.
+               warm_pool_.erase(warm_pool_.begin() + index);
+               return;
+            }
+
+            entry->connected = true;
+
+            // Watch the idle connection: if it becomes readable the
+            // backend has closed it (or is talking out of turn) and
+            // the entry is useless to a future bridge.
+            entry->socket.async_wait(socket_type::wait_read,
+                 [this, entry](const std::error_code& error)
+                 { handle_warm_event(entry,error); });
+         }
+
+         void handle_warm_event(warm_entry* entry, const std::error_code& error)
+         {
+            if (error == asio::error::operation_aborted)
+               return;
+
+            const std::size_t index = find_warm_entry(entry);
+
+            if (index == warm_pool_.size())
+               return;
+
+            warm_pool_.erase(warm_pool_.begin() + index);
+
+            refill_warm_pool();
+         }
+
+         std::unique_ptr<warm_entry> take_warm_upstream()
+         {
+            for (std::size_t i = 0; i < warm_pool_.size(); ++i)
+            {
+               if (warm_pool_[i]->connected)
+               {
+                  std::unique_ptr<warm_entry> entry = std::move(warm_pool_[i]);
+
+                  warm_pool_.erase(warm_pool_.begin() + i);
+
+                  try
+                  {
+                     entry->socket.cancel();
+                  }
+                  catch(std::exception&)
+                  {}
+
+                  return entry;
+               }
+            }
+
+            return std::unique_ptr<warm_entry>();
+         }
+
+         std::size_t find_warm_entry(const warm_entry* entry) const
+         {
+            for (std::size_t i = 0; i < warm_pool_.size(); ++i)
+            {
+               if (warm_pool_[i].get() == entry)
+                  return i;
+            }
+
+            return warm_pool_.size();
+         }
+
+         // Picks up a published configuration change. Bridges in
+         // flight hold pointers into the old backend set for load and
+         // latency accounting, so it is retired rather than mutated;
+         // only new bridges see the fresh set.
+         void maybe_reload_backends()
+         {
+            const unsigned long generation =
+               upstream_generation.load(std::memory_order_acquire);
+
+            if (generation == upstream_seen_)
+               return;
+
+            upstream_seen_ = generation;
+
+            std::unique_ptr<backend_set> fresh(new backend_set());
+
+            parse_backend_list(snapshot_upstream_spec(),upstream_port_,*fresh);
+
+            if (fresh->size() == 0)
+            {
+               std::cerr << "Error: reload: empty upstream list ignored" << std::endl;
+               return;
+            }
+
+            retired_backends_.push_back(std::move(backends_));
+            backends_ = std::move(fresh);
+
+            // Warm connections were established to the old backends;
+            // drop them and warm up against the new set.
+            warm_pool_.clear();
+            refill_warm_pool();
+         }
+
+         void refill_accept_tokens()
+         {
+            const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+            const double elapsed =
+               std::chrono::duration_cast<std::chrono::duration<double>>(now - last_refill_).count();
+
+            last_refill_ = now;
+
+            // Burst capacity of one second's worth of accepts
+            accept_tokens_ = std::min(accept_rate_per_reactor,
+                                      accept_tokens_ + (elapsed * accept_rate_per_reactor));
+         }
+
+         asio::io_context& io_service_;
+         ip::address_v4 localhost_address;
+         ip::tcp::acceptor acceptor_;
+         endpoint_cache endpoint_cache_;
+         buffer_pool pool_;
+         object_pool bridge_pool_;
+         std::vector<std::unique_ptr<warm_entry>> warm_pool_;
+         std::size_t outstanding_accepts_ = 0;
+         std::unique_ptr<backend_set> backends_;
+         std::vector<std::unique_ptr<backend_set>> retired_backends_;
+         unsigned short upstream_port_ = 0;
+         unsigned long upstream_seen_  = 0;
+
+         asio::steady_timer pace_timer_{io_service_};
+         std::chrono::steady_clock::time_point last_refill_ = std::chrono::steady_clock::now();
+         double accept_tokens_       = accept_rate_per_reactor;
+         std::size_t active_bridges_ = 0;
+         bool accept_paused_         = false;
+      };
+
+   };
+}
+
+namespace tcp_proxy
+{
+   /*
+      UDP relay (--udp). Shares the reactor threads with the TCP
+      bridges: each reactor binds its own SO_REUSEPORT datagram
+      socket so the kernel shards flows, keeps a NAT-style session
+      per client endpoint — an upstream-facing socket of its own, so
+      backend replies map back — and expires idle sessions through
+      the reactor's timer wheel. Sessions live in an open-addressing
+      table (linear probing, backward-shift deletion, no tombstones).
+      On Linux datagrams are drained in recvmmsg batches and replies
+      forwarded with sendmmsg, one syscall per burst instead of one
+      per packet, using the same async_wait-plus-native-syscall
+      pattern as the spliced TCP engine.
+   */
+
+   class udp_relay
+   {
+   public:
+
+      enum
+      {
+         batch_size    = 16,    // datagrams per recvmmsg/sendmmsg round
+         max_datagram  = 16384, // larger datagrams are truncated
+         max_rounds    = 8,     // drain bound per readiness event
+         initial_slots = 1024   // session table start size (power of two)
+      };
+
+      udp_relay(asio::io_context& ios,
+                const std::string& local_host, const unsigned short local_port,
+                const std::string& upstream_host, const unsigned short upstream_port)
+      : ios_   (ios),
+        socket_(ios),
+        wheel_ (local_wheel),
+        stats_ (local_stats),
+        slots_ (initial_slots)
+      {
+         ip::udp::endpoint endpoint(asio::ip::make_address_v4(local_host),local_port);
+
+         socket_.open(endpoint.protocol());
+         socket_.set_option(asio::socket_base::reuse_address(true));
+
+         #ifdef SO_REUSEPORT
+         typedef asio::detail::socket_option::boolean<SOL_SOCKET,SO_REUSEPORT> reuse_port;
+         socket_.set_option(reuse_port(true));
+         #endif
+
+         socket_.bind(endpoint);
+         socket_.non_blocking(true);
+
+         // Backends are resolved once at startup; new sessions round
+         // robin across them.
+         backend_set backends;
+         parse_backend_list(upstream_host,upstream_port,backends);
+
+         ip::udp::resolver resolver(ios);
+
+         for (std::size_t i = 0; i < backends.size(); ++i)
+         {
+            const backend_set::backend& backend = backends.at(i);
+
+            backends_.push_back(
+               *resolver.resolve(ip::udp::v4(),
+                                 backend.host,
+                                 std::to_string(backend.port)).begin());
+         }
+
+         if (backends_.empty())
+         {
+            throw std::runtime_error("udp relay: no upstream backends given");
+         }
+      }
+
+      void start()
+      {
+         arm_listen_wait();
+      }
+
+   private:
+
+      struct session
+      {
+         explicit session(asio::io_context& ios)
+         : upstream(ios)
+         {}
+
+         ~session()
+         {
+            if (relay && relay->wheel_)
+            {
+               relay->wheel_->cancel(idle);
+            }
+         }
+
+         ip::udp::endpoint client;
+         ip::udp::socket upstream;
+         udp_relay* relay = nullptr;
+         timer_wheel::entry idle;
+      };
+
+      typedef std::shared_ptr<session> session_ptr;
+
+      /*
+         Session table. Keys are v4 client endpoints folded through a
+         64 bit mixer; lookup is linear probing and deletion shifts
+         the remainder of the cluster back, so probes never cross
+         tombstones.
+      */
+
+      static std::size_t key_of(const ip::udp::endpoint& client)
+      {
+         unsigned long long key =
+            (static_cast<unsigned long long>(client.address().to_v4().to_uint()) << 16) |
+            client.port();
+
+         key ^= key >> 30; key *= 0xbf58476d1ce4e5b9ull;
+         key ^= key >> 27; key *= 0x94d049bb133111ebull;
+         key ^= key >> 31;
+
+         return static_cast<std::size_t>(key);
+      }
+
+      session* find_session(const ip::udp::endpoint& client)
+      {
+         const std::size_t mask = slots_.size() - 1;
+
+         std::size_t slot = key_of(client) & mask;
+
+         while (slots_[slot])
+         {
+            if (slots_[slot]->client == client)
+            {
+               return slots_[slot].get();
+            }
+
+            slot = (slot + 1) & mask;
+         }
+
+         return nullptr;
+      }
+
+      void insert_session(const session_ptr& s)
+      {
+         if ((2 * (count_ + 1)) > slots_.size())
+         {
+            grow_table();
+         }
+
+         const std::size_t mask = slots_.size() - 1;
+
+         std::size_t slot = key_of(s->client) & mask;
+
+         while (slots_[slot])
+         {
+            slot = (slot + 1) & mask;
+         }
+
+         slots_[slot] = s;
+         ++count_;
+      }
+
+      void erase_session(const ip::udp::endpoint& client)
+      {
+         const std::size_t mask = slots_.size() - 1;
+
+         std::size_t slot = key_of(client) & mask;
+
+         while (slots_[slot])
+         {
+            if (slots_[slot]->client == client)
+               break;
+
+            slot = (slot + 1) & mask;
+         }
+
+         if (!slots_[slot])
+            return;
+
+         slots_[slot].reset();
+         --count_;
+
+         std::size_t hole = slot;
+         std::size_t next = (slot + 1) & mask;
+
+         while (slots_[next])
+         {
+            const std::size_t home = key_of(slots_[next]->client) & mask;
+
+            // The entry may move back only if its home slot does not
+            // lie between the hole and its current position.
+            if (((next - home) & mask) >= ((next - hole) & mask))
+            {
+               slots_[hole] = std::move(slots_[next]);
+               hole = next;
+            }
+
+            next = (next + 1) & mask;
+         }
+      }
+
+      void grow_table()
+      {
+         std::vector<session_ptr> old;
+
+         old.swap(slots_);
+         slots_.resize(old.size() * 2);
+         count_ = 0;
+
+         for (std::size_t i = 0; i < old.size(); ++i)
+         {
+            if (old[i])
+            {
+               insert_session(old[i]);
+            }
+         }
+      }
+
+      // ---- client --> upstream ----
+
+      void arm_listen_wait()
+      {
+         socket_.async_wait(ip::udp::socket::wait_read,
+              [this](const std::error_code& error)
+              {
+                 if (error)
+                    return;
+
+                 drain_listen();
+                 arm_listen_wait();
+              });
+      }
+
+      void drain_listen()
+      {
+         #ifdef __linux__
+         struct ::mmsghdr msgs[batch_size];
+         struct ::iovec iov[batch_size];
+         struct ::sockaddr_in addrs[batch_size];
+
+         for (int round = 0; round < max_rounds; ++round)
+         {
+            for (int i = 0; i < batch_size; ++i)
+            {
+               iov[i].iov_base = buffer_[i];
+               iov[i].iov_len  = max_datagram;
+
+               std::memset(&msgs[i].msg_hdr,0,sizeof(msgs[i].msg_hdr));
+
+               msgs[i].msg_hdr.msg_iov     = &iov[i];
+               msgs[i].msg_hdr.msg_iovlen  = 1;
+               msgs[i].msg_hdr.msg_name    = &addrs[i];
+               msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+            }
+
+            const int n = ::recvmmsg(socket_.native_handle(),
+                                     msgs,batch_size,MSG_DONTWAIT,nullptr);
+
+            if (n <= 0)
+               return;
+
+            for (int i = 0; i < n; ++i)
+            {
+               const ip::udp::endpoint client(
+                  ip::address_v4(ntohl(addrs[i].sin_addr.s_addr)),
+                  ntohs(addrs[i].sin_port));
+
+               forward_datagram(client,msgs[i].msg_len,i);
+            }
+
+            if (n < batch_size)
+               return;
+         }
+         #else
+         for (int i = 0; i < (batch_size * max_rounds); ++i)
+         {
+            ip::udp::endpoint client;
+
+            asio::error_code ec;
+
+            const std::size_t size =
+               socket_.receive_from(asio::buffer(buffer_[0],max_datagram),client,0,ec);
+
+            if (ec)
+               return;
+
+            forward_datagram(client,size,0);
+         }
+         #endif
+      }
+
+      void forward_datagram(const ip::udp::endpoint& client,
+                            const std::size_t size, const int index)
+      {
+         session* s = find_session(client);
+
+         if (!s)
+         {
+            s = open_session(client);
+
+            if (!s)
+               return; // no session, no forwarding: drop
+         }
+
+         if (wheel_)
+         {
+            wheel_->arm(s->idle,timer_wheel::ticks(udp_idle_seconds));
+         }
+
+         asio::error_code ec;
+         s->upstream.send(asio::buffer(buffer_[index],size),0,ec);
+
+         if (stats_)
+         {
+            bump(stats_->b_bytes,size);
+            bump(stats_->b_ops);
+         }
+      }
+
+      session* open_session(const ip::udp::endpoint& client)
+      {
+         session_ptr s(new session(ios_));
+
+         s->client = client;
+         s->relay  = this;
+
+         asio::error_code ec;
+
+         s->upstream.open(ip::udp::v4(),ec);
+
+         if (!ec)
+         {
+            // Connected, so the kernel filters replies down to the
+            // chosen backend and plain send()/recv() apply.
+            s->upstream.connect(backends_[next_backend_++ % backends_.size()],ec);
+         }
+
+         if (ec)
+            return nullptr;
+
+         s->upstream.non_blocking(true,ec);
+
+         s->idle.self   = s.get();
+         s->idle.expire = [](void* self)
+            {
+               session* expired = static_cast<session*>(self);
+               expired->relay->expire_session(*expired);
+            };
+
+         insert_session(s);
+         arm_session_wait(s);
+
+         return s.get();
+      }
+
+      void expire_session(session& s)
+      {
+         asio::error_code ec;
+
+         // Aborts the pending wait; the handler's reference releases
+         // the session once it runs.
+         s.upstream.close(ec);
+
+         erase_session(s.client);
+      }
+
+      // ---- upstream --> client ----
+
+      void arm_session_wait(const session_ptr& s)
+      {
+         s->upstream.async_wait(ip::udp::socket::wait_read,
+              [this, s](const std::error_code& error)
+              {
+                 if (error)
+                    return;
+
+                 drain_session(*s);
+                 arm_session_wait(s);
+              });
+      }
+
+      void drain_session(session& s)
+      {
+         if (wheel_)
+         {
+            wheel_->arm(s.idle,timer_wheel::ticks(udp_idle_seconds));
+         }
+
+         #ifdef __linux__
+         struct ::mmsghdr msgs[batch_size];
+         struct ::iovec iov[batch_size];
+         struct ::sockaddr_in client_addr;
+
+         std::memset(&client_addr,0,sizeof(client_addr));
+
+         client_addr.sin_family      = AF_INET;
+         client_addr.sin_addr.s_addr = htonl(s.client.address().to_v4().to_uint());
+         client_addr.sin_port        = htons(s.client.port());
+
+         for (int round = 0; round < max_rounds; ++round)
+         {
+            for (int i = 0; i < batch_size; ++i)
+            {
+               iov[i].iov_base = buffer_[i];
+               iov[i].iov_len  = max_datagram;
+
+               std::memset(&msgs[i].msg_hdr,0,sizeof(msgs[i].msg_hdr));
+
+               msgs[i].msg_hdr.msg_iov    = &iov[i];
+               msgs[i].msg_hdr.msg_iovlen = 1;
+            }
+
+            const int n = ::recvmmsg(s.upstream.native_handle(),
+                                     msgs,batch_size,MSG_DONTWAIT,nullptr);
+
+            if (n <= 0)
+               return;
+
+            // The whole batch goes back to one client, so it leaves
+            // in a single sendmmsg on the listen socket.
+            unsigned long long bytes = 0;
+
+            for (int i = 0; i < n; ++i)
+            {
+               iov[i].iov_len = msgs[i].msg_len;
+               bytes         += msgs[i].msg_len;
+
+               msgs[i].msg_hdr.msg_name    = &client_addr;
+               msgs[i].msg_hdr.msg_namelen = sizeof(client_addr);
+            }
+
+            ::sendmmsg(socket_.native_handle(),msgs,n,0);
+
+            if (stats_)
+            {
+               bump(stats_->a_bytes,bytes);
+               bump(stats_->a_ops,static_cast<unsigned long long>(n));
+            }
+
+            if (n < batch_size)
+               return;
+         }
+         #else
+         for (int i = 0; i < (batch_size * max_rounds); ++i)
+         {
+            asio::error_code ec;
+
+            const std::size_t size =
+               s.upstream.receive(asio::buffer(buffer_[0],max_datagram),0,ec);
+
+            if (ec)
+               return;
+
+            socket_.send_to(asio::buffer(buffer_[0],size),s.client,0,ec);
+
+            if (stats_)
+            {
+               bump(stats_->a_bytes,size);
+               bump(stats_->a_ops);
+            }
+         }
+         #endif
+      }
+
+      asio::io_context& ios_;
+      ip::udp::socket socket_;
+      timer_wheel* wheel_;
+      reactor_counters* stats_;
+
+      std::vector<session_ptr> slots_;
+      std::size_t count_ = 0;
+
+      std::vector<ip::udp::endpoint> backends_;
+      std::size_t next_backend_ = 0;
+
+      char buffer_[batch_size][max_datagram];
+   };
+
+   // Renders the aggregated counters as plain text, one metric per
+   // line, plus a per-reactor breakdown for non-idle reactors.
+   std::string render_stats(const unsigned int reactor_count)
+   {
+      unsigned long long a_bytes        = 0;
+      unsigned long long b_bytes        = 0;
+      unsigned long long a_ops          = 0;
+      unsigned long long b_ops          = 0;
+      unsigned long long accepts        = 0;
+      unsigned long long connect_errors = 0;
+      unsigned long long timeouts       = 0;
+      unsigned long long active_bridges = 0;
+      unsigned long long memory_bytes   = 0;
+
+      for (unsigned int i = 0; (i < reactor_count) && (i < max_reactors); ++i)
+      {
+         const reactor_counters& c = reactor_stats[i];
+
+         a_bytes        += c.a_bytes       .load(std::memory_order_relaxed);
+         b_bytes        += c.b_bytes       .load(std::memory_order_relaxed);
+         a_ops          += c.a_ops         .load(std::memory_order_relaxed);
+         b_ops          += c.b_ops         .load(std::memory_order_relaxed);
+         accepts        += c.accepts       .load(std::memory_order_relaxed);
+         connect_errors += c.connect_errors.load(std::memory_order_relaxed);
+         timeouts       += c.timeouts      .load(std::memory_order_relaxed);
+         active_bridges += c.active_bridges.load(std::memory_order_relaxed);
+         memory_bytes   += c.memory_bytes  .load(std::memory_order_relaxed);
+      }
+
+      std::string body;
+
+      body += "active_bridges "        + std::to_string(active_bridges) + "\n";
+      body += "accepts "               + std::to_string(accepts)        + "\n";
+      body += "connect_errors "        + std::to_string(connect_errors) + "\n";
+      body += "timeouts "              + std::to_string(timeouts)       + "\n";
+      body += "upstream_in_bytes "     + std::to_string(a_bytes)        + "\n";
+      body += "downstream_in_bytes "   + std::to_string(b_bytes)        + "\n";
+      body += "upstream_in_ops "       + std::to_string(a_ops)          + "\n";
+      body += "downstream_in_ops "     + std::to_string(b_ops)          + "\n";
+      body += "memory_bytes "          + std::to_string(memory_bytes)   + "\n";
+
+      for (unsigned int i = 0; (i < reactor_count) && (i < max_reactors); ++i)
+      {
+         const reactor_counters& c = reactor_stats[i];
+
+         body += "reactor " + std::to_string(i) +
+                 " bridges " + std::to_string(c.active_bridges.load(std::memory_order_relaxed)) +
+                 " a_bytes " + std::to_string(c.a_bytes.load(std::memory_order_relaxed)) +
+                 " b_bytes " + std::to_string(c.b_bytes.load(std::memory_order_relaxed)) +
+                 "\n";
+      }
+
+      return body;
+   }
+
+   // Minimal HTTP/1.0 text endpoint for the counters. Runs on its own
+   // thread with blocking I/O; never touches the reactors.
+   void run_stats_endpoint(const unsigned short port, const unsigned int reactor_count)
+   {
+      try
+      {
+         asio::io_context ios;
+
+         ip::tcp::acceptor acceptor(ios,ip::tcp::endpoint(ip::address_v4::any(),port));
+
+         for ( ; ; )
+         {
+            ip::tcp::socket socket(ios);
+
+            acceptor.accept(socket);
+
+            try
+            {
+               const std::string body = render_stats(reactor_count);
+
+               const std::string response =
+                  "HTTP/1.0 200 OK\r\n"
+                  "Content-Type: text/plain\r\n"
+                  "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                  "\r\n" +
+                  body;
+
+               asio::write(socket,asio::buffer(response));
+            }
+            catch(std::exception&)
+            {}
+         }
+      }
+      catch(std::exception& e)
+      {
+         std::cerr << "Error: stats endpoint: " << e.what() << std::endl;
+      }
+   }
+
+   // Drains the per-reactor report rings into the flow log, one line
+   // per closed flow. Runs on its own thread with blocking I/O; the
+   // reactors only ever touch their own ring's producer side.
+   void run_flow_log(const unsigned int reactor_count)
+   {
+      std::ofstream log(flow_log_file.c_str(),std::ios::app);
+
+      if (!log)
+      {
+         std::cerr << "Error: cannot open flow log: " << flow_log_file << std::endl;
+         return;
+      }
+
+      flow_report report;
+
+      for ( ; ; )
+      {
+         bool drained = false;
+
+         for (unsigned int i = 0; i < reactor_count; ++i)
+         {
+            while (flow_report_rings[i].pop(report))
+            {
+               log << "peer="         << report.peer
+                   << " in_bytes="    << report.b_bytes
+                   << " out_bytes="   << report.a_bytes
+                   << " connect_us="  << report.connect_usec
+                   << " duration_ms=" << report.duration_msec
+                   << " samples="     << report.samples;
+
+               if (report.samples > 0)
+               {
+                  log << " fwd_p50_us=" << report.percentile(0.50)
+                      << " fwd_p99_us=" << report.percentile(0.99);
+               }
+
+               log << "\n";
+
+               drained = true;
+            }
+         }
+
+         if (drained)
+         {
+            log.flush();
+         }
+
+         std::this_thread::sleep_for(std::chrono::milliseconds(50));
+      }
+   }
+
+   // Batches the per-reactor access record rings to disk. A fresh
+   // file gets the format header; tcpproxy_logcat renders the result.
+   void run_access_log(const unsigned int reactor_count)
+   {
+      std::ofstream log(access_log_file.c_str(),
+                        std::ios::binary | std::ios::app);
+
+      if (!log)
+      {
+         std::cerr << "Error: cannot open access log: " << access_log_file << std::endl;
+         return;
+      }
+
+      if (log.tellp() == std::streampos(0))
+      {
+         const access_log_header header;
+
+         log.write(reinterpret_cast<const char*>(&header),sizeof(header));
+      }
+
+      access_record record;
+
+      for ( ; ; )
+      {
+         bool drained = false;
+
+         for (unsigned int i = 0; i < reactor_count; ++i)
+         {
+            while (access_log_rings[i].pop(record))
+            {
+               log.write(reinterpret_cast<const char*>(&record),sizeof(record));
+
+               drained = true;
+            }
+         }
+
+         if (drained)
+         {
+            log.flush();
+         }
+
+         std::this_thread::sleep_for(std::chrono::milliseconds(50));
+      }
+   }
+
+   // Loop lag sampler (--profile): arms a timer for a fixed period
+   // and buckets how late its own handler ran past the deadline. One
+   // per reactor, on the reactor's own io_context, so the lag is
+   // exactly the queueing delay a completion handler would have seen
+   // at that moment.
+   class profile_sampler
+   {
+   public:
+
+      enum { tick_msec = 100 };
+
+      profile_sampler(asio::io_context& ios, profile_counters& counters)
+      : timer_   (ios),
+        counters_(counters)
+      {}
+
+      void start()
+      {
+         arm();
+      }
+
+   private:
+
+      void arm()
+      {
+         deadline_ = std::chrono::steady_clock::now() +
+                     std::chrono::milliseconds(static_cast<long>(tick_msec));
+
+         timer_.expires_at(deadline_);
+         timer_.async_wait([this](const std::error_code& error)
+              { tick(error); });
+      }
+
+      void tick(const std::error_code& error)
+      {
+         if (error)
+            return;
+
+         const long long lag_usec =
+            std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now() - deadline_).count();
+
+         profile_lag(counters_,
+                     (lag_usec > 0) ? static_cast<unsigned long long>(lag_usec) : 0);
+
+         arm();
+      }
+
+      asio::steady_timer timer_;
+      profile_counters& counters_;
+      std::chrono::steady_clock::time_point deadline_;
+   };
+
+   // Upper bound in microseconds of the bucket holding the p'th lag
+   // sample; factor-of-two precision, as with the flow reports.
+   unsigned long long lag_percentile(const unsigned long long (&hist)[profile_counters::lag_buckets],
+                                     const unsigned long long samples,
+                                     const double p)
+   {
+      const unsigned long long rank =
+         static_cast<unsigned long long>(p * (samples - 1));
+
+      unsigned long long seen = 0;
+
+      for (unsigned int i = 0; i < profile_counters::lag_buckets; ++i)
+      {
+         seen += hist[i];
+
+         if (seen > rank)
+         {
+            return (1ull << (i + 1));
+         }
+      }
+
+      return (1ull << profile_counters::lag_buckets);
+   }
+
+   // Renders the soak profile as one JSON document: per-reactor
+   // dispatch, allocation and loop lag figures plus an I/O-operations
+   // -per-MB ratio derived from the forwarding counters.
+   std::string render_profile(const unsigned int reactor_count,
+                              const std::chrono::steady_clock::time_point started)
+   {
+      const unsigned long long uptime_sec =
+         static_cast<unsigned long long>(
+            std::chrono::duration_cast<std::chrono::seconds>(
+               std::chrono::steady_clock::now() - started).count());
+
+      std::string body;
+
+      body += "{\n";
+      body += "  \"uptime_sec\": " + std::to_string(uptime_sec) + ",\n";
+      body += "  \"reactors\": [\n";
+
+      unsigned long long total_dispatches = 0;
+      unsigned long long total_misses     = 0;
+      unsigned long long total_bytes      = 0;
+      unsigned long long total_ops        = 0;
+
+      for (unsigned int i = 0; (i < reactor_count) && (i < max_reactors); ++i)
+      {
+         const profile_counters& p = profile_stats[i];
+         const reactor_counters& c = reactor_stats [i];
+
+         unsigned long long hist[profile_counters::lag_buckets];
+
+         for (unsigned int b = 0; b < profile_counters::lag_buckets; ++b)
+         {
+            hist[b] = p.lag[b].load(std::memory_order_relaxed);
+         }
+
+         const unsigned long long samples    = p.lag_samples.load(std::memory_order_relaxed);
+         const unsigned long long dispatches = p.dispatches .load(std::memory_order_relaxed);
+         const unsigned long long hits       = p.pool_hits  .load(std::memory_order_relaxed);
+         const unsigned long long misses     = p.pool_misses.load(std::memory_order_relaxed);
+         const unsigned long long spills     = p.handler_spills.load(std::memory_order_relaxed);
+
+         const unsigned long long bytes =
+            c.a_bytes.load(std::memory_order_relaxed) +
+            c.b_bytes.load(std::memory_order_relaxed);
+
+         const unsigned long long ops =
+            c.a_ops.load(std::memory_order_relaxed) +
+            c.b_ops.load(std::memory_order_relaxed);
+
+         total_dispatches += dispatches;
+         total_misses     += misses;
+         total_bytes      += bytes;
+         total_ops        += ops;
+
+         char ratio[32];
+
+         std::snprintf(ratio,sizeof(ratio),"%.1f",
+                       bytes ? (static_cast<double>(ops) * 1048576.0) /
+                               static_cast<double>(bytes)
+                             : 0.0);
+
+         body += "    { \"reactor\": "      + std::to_string(i)          +
+                 ", \"dispatches\": "       + std::to_string(dispatches) +
+                 ", \"pool_hits\": "        + std::to_string(hits)       +
+                 ", \"pool_misses\": "      + std::to_string(misses)     +
+                 ", \"handler_spills\": "   + std::to_string(spills)     +
+                 ", \"bytes\": "            + std::to_string(bytes)      +
+                 ", \"io_ops\": "           + std::to_string(ops)        +
+                 ", \"est_syscalls_per_mb\": " + ratio                   +
+                 ", \"lag_samples\": "      + std::to_string(samples);
+
+         if (samples > 0)
+         {
+            body += ", \"lag_p50_us\": " + std::to_string(lag_percentile(hist,samples,0.50)) +
+                    ", \"lag_p99_us\": " + std::to_string(lag_percentile(hist,samples,0.99));
+         }
+
+         body += " }";
+         body += ((i + 1) < reactor_count) ? ",\n" : "\n";
+      }
+
+      char total_ratio[32];
+
+      std::snprintf(total_ratio,sizeof(total_ratio),"%.1f",
+                    total_bytes ? (static_cast<double>(total_ops) * 1048576.0) /
+                                  static_cast<double>(total_bytes)
+                                : 0.0);
+
+      body += "  ],\n";
+      body += "  \"total_dispatches\": "  + std::to_string(total_dispatches) + ",\n";
+      body += "  \"total_pool_misses\": " + std::to_string(total_misses)     + ",\n";
+      body += "  \"total_bytes\": "       + std::to_string(total_bytes)      + ",\n";
+      body += "  \"est_syscalls_per_mb\": ";
+      body += total_ratio;
+      body += "\n}\n";
+
+      return body;
+   }
+
+   // Rewrites the report every few seconds; whatever interval the
+   // soak was stopped in, the file on disk is the exit report.
+   void run_profile_report(const unsigned int reactor_count)
+   {
+      const std::chrono::steady_clock::time_point started =
+         std::chrono::steady_clock::now();
+
+      for ( ; ; )
+      {
+         std::this_thread::sleep_for(std::chrono::seconds(5));
+
+         std::ofstream report(profile_file.c_str(),
+                              std::ios::out | std::ios::trunc);
+
+         if (!report)
+         {
+            std::cerr << "Error: cannot open profile report: " << profile_file << std::endl;
+            return;
+         }
+
+         report << render_profile(reactor_count,started);
+      }
+   }
+
+   static void watch_reload(asio::signal_set& signals)
+   {
+      signals.async_wait(
+           [&signals](const std::error_code& error, int)
+           {
+              if (error)
+                 return;
+
+              load_config_file();
+
+              watch_reload(signals);
+           });
+   }
+
+   template <typename DownStream, typename UpStream, typename TransferPolicy>
+   void run_reactor_loop(const std::string& local_host, const unsigned short local_port,
+                         const std::string& forward_host, const unsigned short forward_port)
+   {
+      asio::io_context ios(1);
+
+      throttle_clock throttle(ios);
+      local_throttle = &throttle;
+
+      timer_wheel wheel(ios);
+      local_wheel = &wheel;
+
+      typename tcp_proxy::bridge<DownStream,UpStream,TransferPolicy>::acceptor
+         acceptor(ios,
+                  local_host, local_port,
+                  forward_host, forward_port);
+
+      // One reactor (whichever starts first) owns the SIGHUP watcher;
+      // the published generation fans the change out to the rest.
+      std::unique_ptr<asio::signal_set> reload_signal;
+
+      #ifdef SIGHUP
+      static std::atomic<bool> reload_watcher_claimed {false};
+
+      if (!config_file.empty() && !reload_watcher_claimed.exchange(true))
+      {
+         reload_signal.reset(new asio::signal_set(ios,SIGHUP));
+         watch_reload(*reload_signal);
+      }
+      #endif
+
+      std::unique_ptr<udp_relay> udp;
+
+      if (udp_enable)
+      {
+         udp.reset(new udp_relay(ios,
+                                 local_host, local_port,
+                                 forward_host, forward_port));
+         udp->start();
+      }
+
+      std::unique_ptr<profile_sampler> sampler;
+
+      if (local_profile)
+      {
+         sampler.reset(new profile_sampler(ios,*local_profile));
+         sampler->start();
+      }
+
+      acceptor.accept_connections();
+
+      ios.run();
+   }
+
+   // Chooses the transfer policy for a stream pairing: deployments
+   // with no per-chunk extras run the minimal instantiation.
+   template <typename DownStream, typename UpStream>
+   void run_reactor_variant(const std::string& local_host, const unsigned short local_port,
+                            const std::string& forward_host, const unsigned short forward_port)
+   {
+      const bool plain = (0 == downstream_bps)   &&
+                         !proxy_protocol         &&
+                         flow_log_file.empty()   &&
+                         access_log_file.empty();
+
+      if (plain)
+         run_reactor_loop<DownStream,UpStream,minimal_transfer>
+            (local_host,local_port,forward_host,forward_port);
+      else
+         run_reactor_loop<DownStream,UpStream,full_transfer>
+            (local_host,local_port,forward_host,forward_port);
+   }
+
+   // One reactor per hardware thread. Each reactor owns a private
+   // io_context and its own SO_REUSEPORT acceptor, hence every bridge
+   // lives and dies on a single core with no cross-thread hand-off.
+   // The bridge instantiation is picked once here; the data path
+   // itself never tests for TLS.
+   void run_reactor(const unsigned int reactor_index,
+                    const std::string& local_host, const unsigned short local_port,
+                    const std::string& forward_host, const unsigned short forward_port)
+   {
+      #ifdef __linux__
+      cpu_set_t cpu_set;
+      CPU_ZERO(&cpu_set);
+      CPU_SET(reactor_index % std::thread::hardware_concurrency(),&cpu_set);
+      ::pthread_setaffinity_np(::pthread_self(),sizeof(cpu_set),&cpu_set);
+      #endif
+
+      local_stats = &reactor_stats[reactor_index % max_reactors];
+
+      if (flow_report_rings)
+      {
+         local_flow_ring = &flow_report_rings[reactor_index];
+      }
+
+      if (access_log_rings)
+      {
+         local_access_ring = &access_log_rings[reactor_index];
+      }
+
+      if (profile_stats)
+      {
+         local_profile = &profile_stats[reactor_index % max_reactors];
+      }
+
+      try
+      {
+         #ifdef TCPPROXY_TLS
+         if (tls_terminate && tls_originate)
+            run_reactor_variant<tls_stream_type,tls_stream_type>
+               (local_host,local_port,forward_host,forward_port);
+         else if (tls_terminate)
+            run_reactor_variant<tls_stream_type,ip::tcp::socket>
+               (local_host,local_port,forward_host,forward_port);
+         else if (tls_originate)
+            run_reactor_variant<ip::tcp::socket,tls_stream_type>
+               (local_host,local_port,forward_host,forward_port);
+         else
+         #endif
+         run_reactor_variant<ip::tcp::socket,ip::tcp::socket>
+            (local_host,local_port,forward_host,forward_port);
+      }
+      catch(std::exception& e)
+      {
+         std::cerr << "Error: reactor " << reactor_index << ": " << e.what() << std::endl;
+      }
+   }
+}
+
+int main(int argc, char* argv[])
+{
+   unsigned short stats_port  = 0;
+   std::size_t max_conn_total = 0;
+   double accept_rate_total   = 0;
+
+   #ifdef TCPPROXY_TLS
+   std::string tls_cert_file;
+   std::string tls_key_file;
+   bool tls_upstream = false;
+   #endif
+
+   std::vector<std::string> args;
+
+   for (int i = 1; i < argc; ++i)
+   {
+      const std::string arg = argv[i];
+
+      if (arg == "--splice")
+      {
+         #ifdef __linux__
+         tcp_proxy::engine_mode = tcp_proxy::forwarding_engine::spliced;
+         #else
+         std::cerr << "warning: --splice is linux-only, using buffered engine" << std::endl;
+         #endif
+      }
+      else if (arg == "--coro")
+      {
+         #ifdef ASIO_HAS_CO_AWAIT
+         tcp_proxy::engine_mode = tcp_proxy::forwarding_engine::coroutine;
+         #else
+         std::cerr << "warning: --coro needs C++20 coroutine support, using buffered engine" << std::endl;
+         #endif
+      }
+      else if ((arg == "--highwater") && ((i + 1) < argc))
+      {
+         tcp_proxy::pipeline_high_water = static_cast<std::size_t>(::atol(argv[++i]));
+      }
+      else if ((arg == "--warmpool") && ((i + 1) < argc))
+      {
+         tcp_proxy::warm_pool_target = static_cast<std::size_t>(::atol(argv[++i]));
+      }
+      else if ((arg == "--dnsttl") && ((i + 1) < argc))
+      {
+         tcp_proxy::dns_ttl_seconds = ::atol(argv[++i]);
+      }
+      else if (arg == "--nodelay")
+      {
+         tcp_proxy::tuning.nodelay = true;
+      }
+      else if (arg == "--keepalive")
+      {
+         tcp_proxy::tuning.keepalive = true;
+      }
+      else if ((arg == "--sndbuf") && ((i + 1) < argc))
+      {
+         tcp_proxy::tuning.sndbuf = ::atoi(argv[++i]);
+      }
+      else if ((arg == "--rcvbuf") && ((i + 1) < argc))
+      {
+         tcp_proxy::tuning.rcvbuf = ::atoi(argv[++i]);
+      }
+      else if ((arg == "--fastopen") && ((i + 1) < argc))
+      {
+         tcp_proxy::tuning.fastopen = ::atoi(argv[++i]);
+      }
+      else if ((arg == "--tls-cert") && ((i + 1) < argc))
+      {
+         #ifdef TCPPROXY_TLS
+         tls_cert_file = argv[++i];
+         #else
+         std::cerr << "Error: " << arg << " requires the tcpproxy_server_tls build" << std::endl;
+         return 1;
+         #endif
+      }
+      else if ((arg == "--tls-key") && ((i + 1) < argc))
+      {
+         #ifdef TCPPROXY_TLS
+         tls_key_file = argv[++i];
+         #else
+         std::cerr << "Error: " << arg << " requires the tcpproxy_server_tls build" << std::endl;
+         return 1;
+         #endif
+      }
+      else if (arg == "--tls-upstream")
+      {
+         #ifdef TCPPROXY_TLS
+         tls_upstream = true;
+         #else
+         std::cerr << "Error: " << arg << " requires the tcpproxy_server_tls build" << std::endl;
+         return 1;
+         #endif
+      }
+      else if ((arg == "--config") && ((i + 1) < argc))
+      {
+         tcp_proxy::config_file = argv[++i];
+      }
+      else if ((arg == "--retries") && ((i + 1) < argc))
+      {
+         tcp_proxy::connect_retry_limit =
+            static_cast<unsigned int>(::atoi(argv[++i]));
+      }
+      else if ((arg == "--connecttimeout") && ((i + 1) < argc))
+      {
+         tcp_proxy::connect_timeout_seconds = ::atol(argv[++i]);
+      }
+      else if ((arg == "--idletimeout") && ((i + 1) < argc))
+      {
+         tcp_proxy::idle_timeout_seconds = ::atol(argv[++i]);
+      }
+      else if ((arg == "--writetimeout") && ((i + 1) < argc))
+      {
+         tcp_proxy::write_timeout_seconds = ::atol(argv[++i]);
+      }
+      else if (arg == "--proxyproto")
+      {
+         tcp_proxy::proxy_protocol = true;
+      }
+      else if ((arg == "--maxbps") && ((i + 1) < argc))
+      {
+         tcp_proxy::downstream_bps = static_cast<std::size_t>(::atol(argv[++i]));
+      }
+      else if ((arg == "--maxmem") && ((i + 1) < argc))
+      {
+         tcp_proxy::memory_budget_bytes =
+            static_cast<unsigned long long>(::atoll(argv[++i]));
+      }
+      else if ((arg == "--maxconn") && ((i + 1) < argc))
+      {
+         max_conn_total = static_cast<std::size_t>(::atol(argv[++i]));
+      }
+      else if ((arg == "--acceptrate") && ((i + 1) < argc))
+      {
+         accept_rate_total = ::atof(argv[++i]);
+      }
+      else if ((arg == "--accepts") && ((i + 1) < argc))
+      {
+         tcp_proxy::accept_depth =
+            std::max<std::size_t>(1,static_cast<std::size_t>(::atol(argv[++i])));
+      }
+      else if ((arg == "--stats") && ((i + 1) < argc))
+      {
+         stats_port = static_cast<unsigned short>(::atoi(argv[++i]));
+      }
+      else if ((arg == "--flowlog") && ((i + 1) < argc))
+      {
+         tcp_proxy::flow_log_file = argv[++i];
+      }
+      else if ((arg == "--accesslog") && ((i + 1) < argc))
+      {
+         tcp_proxy::access_log_file = argv[++i];
+      }
+      else if ((arg == "--profile") && ((i + 1) < argc))
+      {
+         tcp_proxy::profile_file = argv[++i];
+      }
+      else if (arg == "--udp")
+      {
+         tcp_proxy::udp_enable = true;
+      }
+      else if ((arg == "--udpidle") && ((i + 1) < argc))
+      {
+         tcp_proxy::udp_idle_seconds = ::atol(argv[++i]);
+      }
+      else if ((arg == "--balance") && ((i + 1) < argc))
+      {
+         const std::string policy = argv[++i];
+
+         if      (policy == "rr"   ) tcp_proxy::upstream_policy = tcp_proxy::balance_policy::round_robin;
+         else if (policy == "least") tcp_proxy::upstream_policy = tcp_proxy::balance_policy::least_connections;
+         else if (policy == "ewma" ) tcp_proxy::upstream_policy = tcp_proxy::balance_policy::ewma_latency;
+         else
+         {
+            std::cerr << "unknown balance policy: " << policy << std::endl;
+            return 1;
+         }
+      }
+      else
+         args.push_back(arg);
+   }
+
+   if ((args.size() < 4) || (args.size() > 5))
+   {
+      std::cerr << "usage: tcpproxy_server [--splice] [--coro] [--highwater <bytes>] [--warmpool <n>] [--dnsttl <seconds>] [--balance rr|least|ewma] [--stats <port>]\n"
+                   "                       [--nodelay] [--keepalive] [--sndbuf <bytes>] [--rcvbuf <bytes>] [--fastopen <qlen>]\n"
+                   "                       [--maxconn <n>] [--acceptrate <per-sec>] [--accepts <n>] [--maxbps <bytes/sec>] [--maxmem <bytes>] [--proxyproto] [--flowlog <file>] [--accesslog <file>] [--profile <file>]\n"
+                   "                       [--retries <n>] [--connecttimeout <sec>] [--idletimeout <sec>] [--writetimeout <sec>] [--config <file>] [--udp] [--udpidle <sec>]\n"
+                   #ifdef TCPPROXY_TLS
+                   "                       [--tls-cert <pem> --tls-key <pem>] [--tls-upstream]\n"
+                   #endif
+                   "                       <local host ip> <local port> <forward host[:port],...> <forward port> [thread count]" << std::endl;
+      return 1;
+   }
+
+   const unsigned short local_port   = static_cast<unsigned short>(::atoi(args[1].c_str()));
+   const unsigned short forward_port = static_cast<unsigned short>(::atoi(args[3].c_str()));
+   const std::string local_host      = args[0];
+
+   // The command line seeds the upstream list; a config file's
+   // upstream directive overrides it now and on every SIGHUP.
+   {
+      std::scoped_lock lock(tcp_proxy::upstream_spec_mutex);
+      tcp_proxy::upstream_spec = args[2];
+   }
+
+   if (!tcp_proxy::config_file.empty())
+   {
+      tcp_proxy::load_config_file();
+   }
+
+   const std::string forward_host = tcp_proxy::snapshot_upstream_spec();
+
+   unsigned int thread_count = (args.size() == 5) ?
+                               static_cast<unsigned int>(::atoi(args[4].c_str())) :
+                               std::thread::hardware_concurrency();
+
+   if (thread_count == 0)
+   {
+      thread_count = 1;
+   }
+
+   // Without SO_REUSEPORT a second bind to the listen endpoint would
+   // fail, so fall back to the classic single reactor mode.
+   #ifndef SO_REUSEPORT
+   thread_count = 1;
+   #endif
+
+   // Kernel-side splicing moves bytes without ever surfacing them to
+   // user space, so the egress token bucket cannot meter them; the
+   // operator's limit beats the fast path.
+   if (
+        (tcp_proxy::engine_mode == tcp_proxy::forwarding_engine::spliced) &&
+        (tcp_proxy::downstream_bps > 0)
+      )
+   {
+      std::cerr << "warning: --splice cannot pace --maxbps, using buffered engine" << std::endl;
+      tcp_proxy::engine_mode = tcp_proxy::forwarding_engine::buffered;
+   }
+
+   #ifdef TCPPROXY_TLS
+   if (!tls_cert_file.empty() || !tls_key_file.empty())
+   {
+      if (tls_cert_file.empty() || tls_key_file.empty())
+      {
+         std::cerr << "Error: --tls-cert and --tls-key must be given together" << std::endl;
+         return 1;
+      }
+
+      try
+      {
+         // Process lifetime, shared by every reactor.
+         asio::ssl::context* context =
+            new asio::ssl::context(asio::ssl::context::tls_server);
+
+         context->set_options(asio::ssl::context::default_workarounds |
+                              asio::ssl::context::no_sslv2            |
+                              asio::ssl::context::no_sslv3);
+
+         context->use_certificate_chain_file(tls_cert_file);
+         context->use_private_key_file(tls_key_file,asio::ssl::context::pem);
+
+         // Session cache plus the default ticket support keep repeat
+         // handshake cost off the accept path.
+         ::SSL_CTX_set_session_cache_mode(context->native_handle(),
+                                          SSL_SESS_CACHE_SERVER);
+
+         tcp_proxy::tls_server_context = context;
+         tcp_proxy::tls_terminate      = true;
+      }
+      catch(std::exception& e)
+      {
+         std::cerr << "Error: tls: " << e.what() << std::endl;
+         return 1;
+      }
+   }
+
+   if (tls_upstream)
+   {
+      asio::ssl::context* context =
+         new asio::ssl::context(asio::ssl::context::tls_client);
+
+      context->set_options(asio::ssl::context::default_workarounds);
+
+      // Upstreams are operator configured, not discovered; certificate
+      // verification is deliberately not performed.
+      context->set_verify_mode(asio::ssl::verify_none);
+
+      ::SSL_CTX_set_session_cache_mode(context->native_handle(),
+                                       SSL_SESS_CACHE_CLIENT);
+
+      tcp_proxy::tls_client_context = context;
+      tcp_proxy::tls_originate      = true;
+   }
+   #endif
+
+   // The overload limits are global; each reactor enforces its share.
+   if (max_conn_total > 0)
+   {
+      tcp_proxy::max_bridges_per_reactor =
+         (max_conn_total + thread_count - 1) / thread_count;
+   }
+
+   if (accept_rate_total > 0)
+   {
+      tcp_proxy::accept_rate_per_reactor = accept_rate_total / thread_count;
+   }
+
+   if (stats_port != 0)
+   {
+      std::thread(tcp_proxy::run_stats_endpoint,stats_port,thread_count).detach();
+   }
+
+   if (!tcp_proxy::flow_log_file.empty())
+   {
+      // One ring per reactor, process lifetime; the logger thread is
+      // the single consumer for all of them.
+      tcp_proxy::flow_report_rings = new tcp_proxy::flow_report_ring[thread_count];
+
+      std::thread(tcp_proxy::run_flow_log,thread_count).detach();
+   }
+
+   if (!tcp_proxy::access_log_file.empty())
+   {
+      tcp_proxy::access_log_rings = new tcp_proxy::access_record_ring[thread_count];
+
+      std::thread(tcp_proxy::run_access_log,thread_count).detach();
+   }
+
+   if (!tcp_proxy::profile_file.empty())
+   {
+      tcp_proxy::profile_stats = new tcp_proxy::profile_counters[thread_count];
+
+      std::thread(tcp_proxy::run_profile_report,thread_count).detach();
+   }
+
+   std::vector<std::thread> reactors;
+
+   for (unsigned int i = 1; i < thread_count; ++i)
+   {
+      reactors.emplace_back(tcp_proxy::run_reactor,
+                            i,
+                            local_host, local_port,
+                            forward_host, forward_port);
+   }
+
+   tcp_proxy::run_reactor(0,
+                          local_host, local_port,
+                          forward_host, forward_port);
+
+   for (std::size_t i = 0; i < reactors.size(); ++i)
+   {
+      reactors[i].join();
    }
 
    return 0;
@@ -325,5 +4995,5 @@ int main(int argc, char* argv[])
 
 /*
  * [Note] On posix systems the tcp proxy server build command is as follows:
- * c++ -pedantic -ansi -Wall -Werror -O3 -o tcpproxy_server tcpproxy_server.cpp -L/usr/lib -lstdc++ -lpthread -lboost_thread -lboost_system
+ * c++ -pedantic -std=c++17 -Wall -Werror -O3 -o tcpproxy_server tcpproxy_server.cpp -L/usr/lib -lstdc++ -lpthread
  */